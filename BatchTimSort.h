@@ -0,0 +1,165 @@
+/*
+BatchTimSort.h
+Sorting of many short independent segments in one call
+1. Offers timSortSegments for segments given by offsets into one flat range or by a list of ranges
+2. Segments not longer than params.minRun of their length go straight to the small run path,
+   longer ones share one merge buffer and one run stack, so memory is not allocated per segment
+3. With a TimSortThreadPool, neighbouring segments are grouped into tasks sorted concurrently
+Every segment is sorted as timSort would sort it
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <utility>
+#include <vector>
+#include "TimSort.h"
+#include "ParallelTimSort.h"
+
+//Segment i is [start + offsets[i], start + offsets[i + 1])
+template <class RandomAccessIterator>
+class OffsetSegments
+{
+public:
+    OffsetSegments(RandomAccessIterator start, const std::vector<std::ptrdiff_t>& offsets):
+        start (start),
+        offsets (offsets)
+
+        {}
+
+    size_t size() const
+    {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    RandomAccessIterator getStart(size_t i) const
+    {
+        return start + offsets[i];
+    }
+
+    RandomAccessIterator getFinish(size_t i) const
+    {
+        return start + offsets[i + 1];
+    }
+
+private:
+    RandomAccessIterator start;
+    const std::vector<std::ptrdiff_t>& offsets;
+};
+
+template <class RandomAccessIterator>
+class RangeSegments
+{
+public:
+    explicit RangeSegments(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& ranges):
+        ranges (ranges)
+
+        {}
+
+    size_t size() const
+    {
+        return ranges.size();
+    }
+
+    RandomAccessIterator getStart(size_t i) const
+    {
+        return ranges[i].first;
+    }
+
+    RandomAccessIterator getFinish(size_t i) const
+    {
+        return ranges[i].second;
+    }
+
+private:
+    const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& ranges;
+};
+
+//Sorts segments from first to last with one merge state and one run stack
+template <class RandomAccessIterator, class Segments, class Compare>
+void sortSegmentGroup(const Segments& segments, size_t first, size_t last, Compare comp, const ITimSortParams& params)
+{
+    NoTimSortStats stats;
+    MergeState<RandomAccessIterator> merge_state(params.getMergeBufferBudget(), 0, params.getGallop(), stats);
+    RunStackMerger<RandomAccessIterator, Compare, ITimSortParams, NoTimSortStats> merger(comp, params, merge_state);
+
+    for (size_t i = first; i < last; i++)
+    {
+        RandomAccessIterator seg_start = segments.getStart(i), seg_finish = segments.getFinish(i);
+        std::ptrdiff_t seg_size = seg_finish - seg_start;
+        if (seg_size < 2)
+            continue;
+
+        //A segment within its minRun is one run extended to its end, as timSort would make it
+        std::ptrdiff_t min_run = params.minRun(seg_size);
+        if (seg_size <= min_run)
+            nextRun(seg_start, seg_finish, comp, min_run, stats);
+        else
+            timSortReusing(seg_start, seg_finish, comp, params, merge_state, merger, stats);
+    }
+}
+
+//Groups of neighbouring segments with about the same number of elements become tasks of the pool
+template <class RandomAccessIterator, class Segments, class Compare>
+void sortSegmentsParallel(const Segments& segments, Compare comp, const ITimSortParams& params, TimSortThreadPool& pool)
+{
+    std::ptrdiff_t total_size = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+        total_size += segments.getFinish(i) - segments.getStart(i);
+
+    const int TASKS_PER_THREAD = 4;
+    std::ptrdiff_t task_size = std::max<std::ptrdiff_t>(total_size / (TASKS_PER_THREAD * pool.getThreadsNumber()),
+                                                        MIN_PARALLEL_LENGTH);
+    std::vector<std::future<void>> futures;
+    size_t group_first = 0;
+    std::ptrdiff_t group_size = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        group_size += segments.getFinish(i) - segments.getStart(i);
+        if (group_size < task_size && i + 1 < segments.size())
+            continue;
+
+        size_t group_last = i + 1;
+        futures.push_back(pool.submit([&segments, group_first, group_last, comp, &params]() {
+            sortSegmentGroup<RandomAccessIterator>(segments, group_first, group_last, comp, params);
+        }));
+        group_first = group_last;
+        group_size = 0;
+    }
+    waitAll(futures);
+}
+
+//offsets are non-decreasing, segment i is [start + offsets[i], start + offsets[i + 1])
+template <class RandomAccessIterator, class Compare>
+void timSortSegments(RandomAccessIterator start, const std::vector<std::ptrdiff_t>& offsets, Compare comp,
+                     const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    OffsetSegments<RandomAccessIterator> segments(start, offsets);
+    sortSegmentGroup<RandomAccessIterator>(segments, 0, segments.size(), comp, params);
+}
+
+template <class RandomAccessIterator, class Compare>
+void timSortSegments(RandomAccessIterator start, const std::vector<std::ptrdiff_t>& offsets, Compare comp,
+                     TimSortThreadPool& pool, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    OffsetSegments<RandomAccessIterator> segments(start, offsets);
+    sortSegmentsParallel<RandomAccessIterator>(segments, comp, params, pool);
+}
+
+//Ranges must not overlap
+template <class RandomAccessIterator, class Compare>
+void timSortSegments(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& ranges, Compare comp,
+                     const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    RangeSegments<RandomAccessIterator> segments(ranges);
+    sortSegmentGroup<RandomAccessIterator>(segments, 0, segments.size(), comp, params);
+}
+
+template <class RandomAccessIterator, class Compare>
+void timSortSegments(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& ranges, Compare comp,
+                     TimSortThreadPool& pool, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    RangeSegments<RandomAccessIterator> segments(ranges);
+    sortSegmentsParallel<RandomAccessIterator>(segments, comp, params, pool);
+}
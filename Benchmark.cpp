@@ -0,0 +1,21 @@
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include "Benchmark.h"
+
+//Usage: Benchmark [max_size] [output.json], sizes up to 1e6 and standard output by default
+int main(int argc, char* argv[])
+{
+    std::ptrdiff_t max_size = (argc > 1) ? std::atoll(argv[1]) : 1000000;
+
+    if (argc > 2)
+    {
+        std::ofstream out(argv[2]);
+        runBenchmarks(max_size, out);
+    }
+    else
+        runBenchmarks(max_size, std::cout);
+
+    return 0;
+}
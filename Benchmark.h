@@ -0,0 +1,288 @@
+/*
+Benchmark.h
+Benchmark suite comparing timSort with std::sort and std::stable_sort
+1. Offers input distributions: random, sorted, reversed, sawtooth, organ pipe, few unique,
+   sorted with a random tail, partially sorted and concatenation of sorted runs
+2. Offers element types: int, 64-bit integers, double, string and a Point3D-like struct,
+   all built from the same integer keys
+3. Offers runBenchmarks: a warm-up and repeated runs on fresh copies of the input, reported
+   as ns per element (mean, standard deviation, min, median, 90th percentile) and
+   the number of comparisons, in JSON
+4. Comparisons are counted in a separate run with CountingCompare. For timSort on arithmetic types
+   it turns off the SIMD and sorting network paths, so that count is reported as
+   generic_path_comparisons: it is that of the generic path, not of the timed runs.
+   std::sort and std::stable_sort have one path, their counts are always comparisons
+*/
+
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "TimSort.h"
+
+typedef void (*KeyGenerator)(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random);
+
+const long long BENCH_KEY_RANGE = 1000000000LL;
+const int BENCH_FEW_UNIQUE_KEYS = 16;
+const int BENCH_PARTIAL_SORTS = 15;
+const int BENCH_WARM_UP_RUNS = 1;
+const int BENCH_MIN_RUNS = 5;
+const int BENCH_MAX_RUNS = 50;
+//Elements sorted by all timed runs of one case, more runs are made for small inputs
+const std::ptrdiff_t BENCH_ELEMENTS_PER_CASE = 10000000;
+
+void generateRandomKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    keys.resize(len);
+    for (std::ptrdiff_t i = 0; i < len; i++)
+        keys[i] = static_cast<long long>(random() % BENCH_KEY_RANGE);
+}
+
+void generateSortedKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    generateRandomKeys(keys, len, random);
+    std::sort(keys.begin(), keys.end());
+}
+
+void generateReversedKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    generateSortedKeys(keys, len, random);
+    std::reverse(keys.begin(), keys.end());
+}
+
+//Ascending runs of sqrt(len) elements each
+void generateSawtoothKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64&)
+{
+    std::ptrdiff_t period = std::max<std::ptrdiff_t>(1, static_cast<std::ptrdiff_t>(sqrt(static_cast<double>(len))));
+    keys.resize(len);
+    for (std::ptrdiff_t i = 0; i < len; i++)
+        keys[i] = i % period;
+}
+
+//Ascending first half, descending second half
+void generateOrganPipeKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64&)
+{
+    keys.resize(len);
+    for (std::ptrdiff_t i = 0; i < len; i++)
+        keys[i] = std::min(i, len - 1 - i);
+}
+
+void generateFewUniqueKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    keys.resize(len);
+    for (std::ptrdiff_t i = 0; i < len; i++)
+        keys[i] = static_cast<long long>(random() % BENCH_FEW_UNIQUE_KEYS);
+}
+
+//Sorted array with 1% of random elements appended
+void generateAppendedTailKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    generateRandomKeys(keys, len, random);
+    std::sort(keys.begin(), keys.begin() + (len - len / 100));
+}
+
+void generatePartiallySortedKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    generateRandomKeys(keys, len, random);
+    for (int k = 0; k < BENCH_PARTIAL_SORTS && len > 0; k++)
+    {
+        std::ptrdiff_t start = static_cast<std::ptrdiff_t>(random() % len);
+        std::ptrdiff_t finish = start + static_cast<std::ptrdiff_t>(random() % (len - start + 1));
+        std::sort(keys.begin() + start, keys.begin() + finish);
+    }
+}
+
+//Sorted runs with lengths from 16 to 4096
+void generateRunConcatenationKeys(std::vector<long long>& keys, std::ptrdiff_t len, std::mt19937_64& random)
+{
+    generateRandomKeys(keys, len, random);
+    std::ptrdiff_t run_start = 0;
+    while (run_start < len)
+    {
+        std::ptrdiff_t run_len = std::ptrdiff_t(16) << (random() % 9);
+        std::ptrdiff_t run_finish = std::min(len, run_start + run_len);
+        std::sort(keys.begin() + run_start, keys.begin() + run_finish);
+        run_start = run_finish;
+    }
+}
+
+struct BenchDistribution
+{
+    const char* name;
+    KeyGenerator generate;
+};
+
+const BenchDistribution BENCH_DISTRIBUTIONS[] = {
+    {"random", generateRandomKeys},
+    {"sorted", generateSortedKeys},
+    {"reversed", generateReversedKeys},
+    {"sawtooth", generateSawtoothKeys},
+    {"organ_pipe", generateOrganPipeKeys},
+    {"few_unique", generateFewUniqueKeys},
+    {"appended_tail", generateAppendedTailKeys},
+    {"partially_sorted", generatePartiallySortedKeys},
+    {"run_concatenation", generateRunConcatenationKeys}
+};
+
+class BenchPoint
+{
+public:
+    int x, y, z;
+
+    bool operator <(const BenchPoint& that) const
+    {
+        return (x < that.x);
+    }
+};
+
+//Element types are made from keys, so every type sees the same order
+inline void makeValue(long long key, int& value) { value = static_cast<int>(key); }
+inline void makeValue(long long key, long long& value) { value = key * 4096 - BENCH_KEY_RANGE; }
+inline void makeValue(long long key, double& value) { value = static_cast<double>(key) / 7.0; }
+
+inline void makeValue(long long key, std::string& value)
+{
+    char digits[32];
+    snprintf(digits, sizeof(digits), "key_%012lld", key);
+    value = digits;
+}
+
+inline void makeValue(long long key, BenchPoint& value)
+{
+    value.x = static_cast<int>(key);
+    value.y = static_cast<int>(key % 1000);
+    value.z = 0;
+}
+
+struct BenchAlgorithm
+{
+    const char* name;
+    int id;
+};
+
+const BenchAlgorithm BENCH_ALGORITHMS[] = {
+    {"timSort", 0},
+    {"std::sort", 1},
+    {"std::stable_sort", 2}
+};
+
+template <class RandomAccessIterator, class Compare>
+void runBenchAlgorithm(int algorithm_id, RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    if (algorithm_id == 0)
+        timSort(start, finish, comp);
+    else if (algorithm_id == 1)
+        std::sort(start, finish, comp);
+    else
+        std::stable_sort(start, finish, comp);
+}
+
+struct BenchResult
+{
+    double mean, stddev, min, median, p90;
+    long long comparisons;
+    int n_runs;
+};
+
+template <class Type>
+BenchResult measureSort(int algorithm_id, const std::vector<Type>& input)
+{
+    std::ptrdiff_t len = input.size();
+    int n_runs = static_cast<int>(std::max<std::ptrdiff_t>(BENCH_MIN_RUNS,
+                                  std::min<std::ptrdiff_t>(BENCH_MAX_RUNS, BENCH_ELEMENTS_PER_CASE / std::max<std::ptrdiff_t>(len, 1))));
+    std::vector<double> ns_per_element;
+
+    for (int run = 0; run < BENCH_WARM_UP_RUNS + n_runs; run++)
+    {
+        std::vector<Type> arr(input);
+        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+        runBenchAlgorithm(algorithm_id, arr.begin(), arr.end(), std::less<Type>());
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_time;
+
+        if (run >= BENCH_WARM_UP_RUNS)
+            ns_per_element.push_back(elapsed.count() / std::max<std::ptrdiff_t>(len, 1));
+    }
+
+    BenchResult result;
+    result.n_runs = n_runs;
+    result.mean = 0;
+    for (size_t i = 0; i < ns_per_element.size(); i++)
+        result.mean += ns_per_element[i] / n_runs;
+    result.stddev = 0;
+    for (size_t i = 0; i < ns_per_element.size(); i++)
+        result.stddev += (ns_per_element[i] - result.mean) * (ns_per_element[i] - result.mean) / n_runs;
+    result.stddev = sqrt(result.stddev);
+
+    std::sort(ns_per_element.begin(), ns_per_element.end());
+    result.min = ns_per_element.front();
+    result.median = ns_per_element[ns_per_element.size() / 2];
+    result.p90 = ns_per_element[ns_per_element.size() * 9 / 10];
+
+    //One untimed run counts the comparisons
+    std::vector<Type> arr(input);
+    TimSortStats stats;
+    runBenchAlgorithm(algorithm_id, arr.begin(), arr.end(),
+                      CountingCompare<std::less<Type>, TimSortStats>(std::less<Type>(), stats));
+    result.comparisons = stats.n_comparisons;
+    return result;
+}
+
+template <class Type>
+void benchmarkType(const char* type_name, const std::vector<std::ptrdiff_t>& sizes, std::ostream& out, bool& first_record)
+{
+    std::mt19937_64 random(2016);
+
+    for (size_t size_i = 0; size_i < sizes.size(); size_i++)
+    {
+        for (size_t dist_i = 0; dist_i < sizeof(BENCH_DISTRIBUTIONS) / sizeof(BENCH_DISTRIBUTIONS[0]); dist_i++)
+        {
+            std::vector<long long> keys;
+            BENCH_DISTRIBUTIONS[dist_i].generate(keys, sizes[size_i], random);
+            std::vector<Type> input(keys.size());
+            for (size_t i = 0; i < keys.size(); i++)
+                makeValue(keys[i], input[i]);
+
+            for (size_t alg_i = 0; alg_i < sizeof(BENCH_ALGORITHMS) / sizeof(BENCH_ALGORITHMS[0]); alg_i++)
+            {
+                BenchResult result = measureSort(BENCH_ALGORITHMS[alg_i].id, input);
+                bool generic_path = BENCH_ALGORITHMS[alg_i].id == 0 && std::is_arithmetic<Type>::value;
+                const char* comparisons_field = generic_path ? "generic_path_comparisons" : "comparisons";
+
+                out << (first_record ? "\n" : ",\n");
+                first_record = false;
+                out << "  {\"type\": \"" << type_name << "\", \"distribution\": \"" << BENCH_DISTRIBUTIONS[dist_i].name
+                    << "\", \"size\": " << sizes[size_i] << ", \"algorithm\": \"" << BENCH_ALGORITHMS[alg_i].name
+                    << "\", \"runs\": " << result.n_runs << ", \"" << comparisons_field << "\": " << result.comparisons
+                    << ", \"ns_per_element\": {\"mean\": " << result.mean << ", \"stddev\": " << result.stddev
+                    << ", \"min\": " << result.min << ", \"median\": " << result.median
+                    << ", \"p90\": " << result.p90 << "}}";
+                out.flush();
+            }
+        }
+    }
+}
+
+//Sizes are powers of ten from 1000 to max_size, results are a JSON array of records
+void runBenchmarks(std::ptrdiff_t max_size, std::ostream& out)
+{
+    std::vector<std::ptrdiff_t> sizes;
+    for (std::ptrdiff_t size = 1000; size <= max_size; size *= 10)
+        sizes.push_back(size);
+
+    bool first_record = true;
+    out << "[";
+    benchmarkType<int>("int", sizes, out, first_record);
+    benchmarkType<long long>("int64", sizes, out, first_record);
+    benchmarkType<double>("double", sizes, out, first_record);
+    benchmarkType<std::string>("string", sizes, out, first_record);
+    benchmarkType<BenchPoint>("point", sizes, out, first_record);
+    out << "\n]\n";
+}
@@ -0,0 +1,433 @@
+/*
+BufferedMerge.h
+Merging of two adjacent runs using auxiliary memory bounded by ITimSortParams::getMergeBufferBudget
+1. Offers template class MergeState which keeps auxiliary memory and min_gallop between merges of one sort.
+   The memory is uninitialized: elements are move-constructed into it for a merge and destroyed after it,
+   so element types need no default constructor
+2. Buffered merge: the smaller run is moved to the buffer and merged in a single pass.
+   Arithmetic types are merged by SimdMerge.h kernels in windows of buffered elements, between windows
+   blocks found by galloping are copied at once. Windows grow from MIN_KERNEL_WINDOW to MAX_KERNEL_WINDOW
+   while galloping fails, so random inputs spend little on it
+3. Hybrid merge: runs are split by rotations until the smaller part fits into the buffer
+4. Offers mergeRuns trimming elements already in place and choosing between buffered,
+   hybrid and inplaceMerge
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <iterator>
+#include "Run.h"
+#include "InplaceMerge.h"
+#include "SimdMerge.h"
+#include "TimSortStats.h"
+
+const std::ptrdiff_t MIN_KERNEL_WINDOW = 256;
+const std::ptrdiff_t MAX_KERNEL_WINDOW = 4096;
+const std::ptrdiff_t MIN_KERNEL_GALLOP = 64;
+
+//Merge state of one sort: auxiliary memory, the adaptive galloping threshold and the stats sink
+template <class RandomAccessIterator, class Stats = NoTimSortStats>
+class MergeState
+{
+public:
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    typedef ValueType* BufferIterator;
+
+    MergeState(size_t budget_bytes, std::ptrdiff_t arr_size, int initial_gallop, Stats& stats):
+        data (nullptr),
+        allocated (0),
+        budget_bytes (budget_bytes),
+        gallop (initial_gallop),
+        inplace_stable (false),
+        stats (stats)
+    {
+        restart(arr_size);
+    }
+
+    ~MergeState()
+    {
+        release();
+    }
+
+    MergeState(const MergeState&) = delete;
+    MergeState& operator =(const MergeState&) = delete;
+
+    //Prepares the state for the next sort, keeping the memory already allocated
+    void restart(std::ptrdiff_t arr_size)
+    {
+        size_t max_needed = static_cast<size_t>(arr_size / 2);
+        max_elems = static_cast<std::ptrdiff_t>(std::min(budget_bytes / sizeof(ValueType), max_needed));
+        min_gallop = gallop;
+    }
+
+    std::ptrdiff_t getCapacity() const
+    {
+        return max_elems;
+    }
+
+    int getGallop() const
+    {
+        return gallop;
+    }
+
+    int& getMinGallop()
+    {
+        return min_gallop;
+    }
+
+    Stats& getStats()
+    {
+        return stats;
+    }
+
+    //Merges without a buffer go through symMerge instead of the faster but unstable inplaceMerge
+    void makeInplaceStable()
+    {
+        inplace_stable = true;
+    }
+
+    bool isInplaceStable() const
+    {
+        return inplace_stable;
+    }
+
+    //Memory allocated so far, nullptr and 0 before the first merge which needs it
+    const ValueType* getBuffer() const
+    {
+        return data;
+    }
+
+    std::ptrdiff_t getAllocated() const
+    {
+        return allocated;
+    }
+
+    //Uninitialized memory for n_elems elements. It is allocated lazily, so sorts which never merge
+    //big runs stay cheap, grows geometrically up to the capacity and is kept by restart
+    BufferIterator reserve(std::ptrdiff_t n_elems)
+    {
+        if (allocated < n_elems)
+        {
+            std::ptrdiff_t new_size = std::max(n_elems, std::min(2 * allocated, max_elems));
+            release();
+            data = allocator.allocate(new_size);
+            allocated = new_size;
+        }
+        return data;
+    }
+
+private:
+    void release()
+    {
+        if (data != nullptr)
+            allocator.deallocate(data, allocated);
+        data = nullptr;
+        allocated = 0;
+    }
+
+    std::allocator<ValueType> allocator;
+    ValueType* data;
+    std::ptrdiff_t allocated;
+    size_t budget_bytes;
+    std::ptrdiff_t max_elems;
+    int gallop;
+    int min_gallop;
+    bool inplace_stable;
+    Stats& stats;
+};
+
+//Binary searches take the key by iterator, because comparators may accept non-const references
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator findFirstNotLess(RandomAccessIterator start, RandomAccessIterator finish,
+                                      RandomAccessIterator key, Compare comp)
+{
+    while (start < finish)
+    {
+        RandomAccessIterator med = start + (finish - start) / 2;
+        if (comp(*med, *key))
+            start = med + 1;
+        else
+            finish = med;
+    }
+    return start;
+}
+
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator findFirstGreater(RandomAccessIterator start, RandomAccessIterator finish,
+                                      RandomAccessIterator key, Compare comp)
+{
+    while (start < finish)
+    {
+        RandomAccessIterator med = start + (finish - start) / 2;
+        if (comp(*key, *med))
+            finish = med;
+        else
+            start = med + 1;
+    }
+    return start;
+}
+
+//Elements move-constructed in the merge buffer, destroyed when the merge is over even if comp throws
+template <class Type>
+class BufferedElements
+{
+public:
+    template <class RandomAccessIterator>
+    BufferedElements(RandomAccessIterator start, RandomAccessIterator finish, Type* buffer):
+        buffer (buffer),
+        size (finish - start)
+    {
+        std::uninitialized_copy(std::make_move_iterator(start), std::make_move_iterator(finish), buffer);
+    }
+
+    ~BufferedElements()
+    {
+        for (std::ptrdiff_t i = 0; i < size; i++)
+            buffer[i].~Type();
+    }
+
+    BufferedElements(const BufferedElements&) = delete;
+    BufferedElements& operator =(const BufferedElements&) = delete;
+
+private:
+    Type* buffer;
+    std::ptrdiff_t size;
+};
+
+template <class RandomAccessIterator, class Compare, class Stats>
+void bufferedMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp,
+                   MergeState<RandomAccessIterator, Stats>& state, std::false_type)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    if (left.size <= right.size)
+    {
+        ValueType* buffer = state.reserve(left.size);
+        BufferedElements<ValueType> buffered(left.start, right.start, buffer);
+        state.getStats().countMoves(left.size);
+        mergeBufferedLeft(left, right, buffer, comp, WM_ERASING_WRITE,
+                          state.getGallop(), state.getMinGallop(), state.getStats());
+    }
+    else
+    {
+        ValueType* buffer = state.reserve(right.size);
+        BufferedElements<ValueType> buffered(right.start, right.start + right.size, buffer);
+        state.getStats().countMoves(right.size);
+        mergeBufferedRight(left, right, buffer, comp, WM_ERASING_WRITE,
+                           state.getGallop(), state.getMinGallop(), state.getStats());
+    }
+}
+
+//Left is in the buffer. Every step copies the right elements less than the head of left and the left
+//elements not greater than the head of right; unless one of the blocks is long enough to gallop, the next
+//window of left is merged by the kernels with the right elements less than its last element
+template <class Type, class Compare, class Stats>
+void gallopingFastMergeLow(const Type* left, std::ptrdiff_t left_size, Type* right, std::ptrdiff_t right_size,
+                           Type* dest, Compare comp, int gallop, int& min_gallop, Stats& stats)
+{
+    const Type* left_finish = left + left_size;
+    Type* right_finish = right + right_size;
+    bool galloping = false;
+    std::ptrdiff_t window = MIN_KERNEL_WINDOW;
+
+    while (left != left_finish && right != right_finish)
+    {
+        std::ptrdiff_t n_right = gallopLeft(left, right, right_finish - right, 0, comp);
+        dest = std::copy(right, right + n_right, dest);
+        right += n_right;
+        if (right == right_finish)
+            break;
+
+        std::ptrdiff_t n_left = gallopRight(right, left, left_finish - left, 0, comp);
+        dest = std::copy(left, left + n_left, dest);
+        left += n_left;
+        if (left == left_finish)
+            break;
+
+        //As in mergeRunsWithBuffer, min_gallop long blocks start galloping and gallop long ones continue it,
+        //but blocks shorter than MIN_KERNEL_GALLOP are merged by the kernels about as fast
+        std::ptrdiff_t threshold = std::max<std::ptrdiff_t>(galloping ? gallop : min_gallop, MIN_KERNEL_GALLOP);
+        if (n_left >= threshold || n_right >= threshold)
+        {
+            if (!galloping)
+                stats.countGallopEntry();
+            stats.countGallopSuccess();
+            galloping = true;
+            window = MIN_KERNEL_WINDOW;
+            if (min_gallop > 1)
+                min_gallop--;
+            continue;
+        }
+        if (galloping)
+            min_gallop++;
+        galloping = false;
+
+        std::ptrdiff_t n_window_left = std::min(window, left_finish - left);
+        std::ptrdiff_t n_window_right = gallopLeft(left + n_window_left - 1, right, right_finish - right, 0, comp);
+        fastMergeLow(left, n_window_left, right, n_window_right, dest, comp);
+        left += n_window_left;
+        right += n_window_right;
+        dest += n_window_left + n_window_right;
+        window = std::min(2 * window, MAX_KERNEL_WINDOW);
+    }
+
+    //Remaining elements of the right run are already in place
+    std::copy(left, left_finish, dest);
+}
+
+//Right is in the buffer, the merge goes from the right end as gallopingFastMergeLow goes from the left one
+template <class Type, class Compare, class Stats>
+void gallopingFastMergeHigh(Type* left, std::ptrdiff_t left_size, const Type* right, std::ptrdiff_t right_size,
+                            Compare comp, int gallop, int& min_gallop, Stats& stats)
+{
+    Type* left_finish = left + left_size;
+    const Type* right_finish = right + right_size;
+    Type* dest_finish = left_finish + right_size;
+    bool galloping = false;
+    std::ptrdiff_t window = MIN_KERNEL_WINDOW;
+
+    while (left != left_finish && right != right_finish)
+    {
+        std::ptrdiff_t left_len = left_finish - left;
+        std::ptrdiff_t n_left = left_len - gallopRight(right_finish - 1, left, left_len, left_len - 1, comp);
+        dest_finish = std::copy_backward(left_finish - n_left, left_finish, dest_finish);
+        left_finish -= n_left;
+        if (left == left_finish)
+            break;
+
+        std::ptrdiff_t right_len = right_finish - right;
+        std::ptrdiff_t n_right = right_len - gallopLeft(left_finish - 1, right, right_len, right_len - 1, comp);
+        dest_finish = std::copy_backward(right_finish - n_right, right_finish, dest_finish);
+        right_finish -= n_right;
+        if (right == right_finish)
+            break;
+
+        //As in mergeRunsWithBuffer, min_gallop long blocks start galloping and gallop long ones continue it,
+        //but blocks shorter than MIN_KERNEL_GALLOP are merged by the kernels about as fast
+        std::ptrdiff_t threshold = std::max<std::ptrdiff_t>(galloping ? gallop : min_gallop, MIN_KERNEL_GALLOP);
+        if (n_left >= threshold || n_right >= threshold)
+        {
+            if (!galloping)
+                stats.countGallopEntry();
+            stats.countGallopSuccess();
+            galloping = true;
+            window = MIN_KERNEL_WINDOW;
+            if (min_gallop > 1)
+                min_gallop--;
+            continue;
+        }
+        if (galloping)
+            min_gallop++;
+        galloping = false;
+
+        std::ptrdiff_t n_window_right = std::min(window, right_finish - right);
+        const Type* window_start = right_finish - n_window_right;
+        left_len = left_finish - left;
+        std::ptrdiff_t n_window_left = left_len - gallopRight(window_start, left, left_len, left_len - 1, comp);
+        fastMergeHigh(left_finish - n_window_left, n_window_left, window_start, n_window_right, dest_finish, comp);
+        left_finish -= n_window_left;
+        right_finish = window_start;
+        dest_finish -= n_window_right + n_window_left;
+        window = std::min(2 * window, MAX_KERNEL_WINDOW);
+    }
+
+    //Remaining elements of the left run are already in place
+    std::copy_backward(right, right_finish, dest_finish);
+}
+
+//Arithmetic elements in contiguous memory are merged by SimdMerge.h kernels, with galloping
+//between kernel windows unless it is turned off
+template <class RandomAccessIterator, class Compare, class Stats>
+void bufferedMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp,
+                   MergeState<RandomAccessIterator, Stats>& state, std::true_type)
+{
+    typename MergeState<RandomAccessIterator, Stats>::BufferIterator buffer_start;
+    //Runs shorter than one window gain too little from galloping to pay for the searches
+    bool use_gallop = state.getGallop() != NO_GALLOPING_MODE && std::min(left.size, right.size) > MAX_KERNEL_WINDOW;
+    if (left.size <= right.size)
+    {
+        buffer_start = state.reserve(left.size);
+        std::uninitialized_copy(left.start, right.start, buffer_start);
+        if (use_gallop)
+            gallopingFastMergeLow(&*buffer_start, left.size, &*right.start, right.size, &*left.start, comp,
+                                  state.getGallop(), state.getMinGallop(), state.getStats());
+        else
+            fastMergeLow(&*buffer_start, left.size, &*right.start, right.size, &*left.start, comp);
+    }
+    else
+    {
+        buffer_start = state.reserve(right.size);
+        std::uninitialized_copy(right.start, right.start + right.size, buffer_start);
+        if (use_gallop)
+            gallopingFastMergeHigh(&*left.start, left.size, &*buffer_start, right.size, comp,
+                                   state.getGallop(), state.getMinGallop(), state.getStats());
+        else
+            fastMergeHigh(&*left.start, left.size, &*buffer_start, right.size, comp);
+    }
+    state.getStats().countMoves(left.size + right.size + std::min(left.size, right.size));
+}
+
+template <class RandomAccessIterator, class Compare, class Stats>
+void bufferedMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp,
+                   MergeState<RandomAccessIterator, Stats>& state)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    const bool USE_KERNELS = IsBranchlessMergeable<ValueType, Compare>::value &&
+                             IsContiguousIterator<RandomAccessIterator>::value;
+    bufferedMerge(left, right, comp, state, std::integral_constant<bool, USE_KERNELS>());
+}
+
+template <class RandomAccessIterator, class Compare, class Stats>
+void hybridMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp,
+                 MergeState<RandomAccessIterator, Stats>& state)
+{
+    if (left.size == 0 || right.size == 0)
+        return;
+
+    if (std::min(left.size, right.size) <= state.getCapacity())
+    {
+        bufferedMerge(left, right, comp, state);
+        return;
+    }
+
+    RandomAccessIterator left_cut, right_cut;
+    if (left.size > right.size)
+    {
+        left_cut = left.start + left.size / 2;
+        right_cut = findFirstNotLess(right.start, right.start + right.size, left_cut, comp);
+    }
+    else
+    {
+        right_cut = right.start + right.size / 2;
+        left_cut = findFirstGreater(left.start, right.start, right_cut, comp);
+    }
+
+    RandomAccessIterator new_middle = std::rotate(left_cut, right.start, right_cut);
+    state.getStats().countMoves(right_cut - left_cut);
+
+    Run<RandomAccessIterator> first_left = {left.start, left_cut - left.start};
+    Run<RandomAccessIterator> first_right = {left_cut, new_middle - left_cut};
+    Run<RandomAccessIterator> second_left = {new_middle, right_cut - new_middle};
+    Run<RandomAccessIterator> second_right = {right_cut, right.start + right.size - right_cut};
+
+    hybridMerge(first_left, first_right, comp, state);
+    hybridMerge(second_left, second_right, comp, state);
+}
+
+template <class RandomAccessIterator, class Compare, class Stats>
+void mergeRuns(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp,
+               MergeState<RandomAccessIterator, Stats>& state)
+{
+    state.getStats().countMerge();
+    if (!trimRunsForMerge(left, right, comp))
+        return;
+
+    if (state.getCapacity() == 0 && state.isInplaceStable())
+        symMerge(left.start, right.start, right.start + right.size, comp);
+    else if (state.getCapacity() == 0)
+        inplaceMerge(left, right, comp, state.getGallop());
+    else
+        hybridMerge(left, right, comp, state);
+}
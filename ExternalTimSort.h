@@ -0,0 +1,486 @@
+/*
+ExternalTimSort.h
+Sorting of binary files of fixed-size records which do not fit into memory
+1. Offers class IExternalSortParams with pure virtual functions to set up the external sort
+   and a DefaultExternalSortParams class: memory budget, I/O buffer size and temporary directory
+2. Offers externalTimSort: chunks fitting into the memory budget are sorted by timSort and spilled
+   to a temporary file. A chunk continuing the previous one (its first record is not less than
+   the last record written) extends the previous run, so partially ordered input gives
+   few long runs. Runs are merged k at a time with buffered sequential reads and writes
+   (pread and pwrite) until one is left
+3. Every run is read through two halves of its buffer: while one is merged, a worker thread
+   reads the next part of the run into the other, so merging does not wait for the disk
+Records must be trivially copyable; the sort is stable
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+#include "TimSort.h"
+#include "ParallelTimSort.h"
+
+class IExternalSortParams
+{
+public:
+    //Bytes of memory for the chunk being sorted, or for the I/O buffers of one merge
+    virtual size_t getMemoryBudget() const PURE;
+    //Bytes read or written by one system call
+    virtual size_t getIoBufferSize() const PURE;
+    virtual std::string getTempDirectory() const PURE;
+};
+
+class DefaultExternalSortParams : public IExternalSortParams
+{
+public:
+    explicit DefaultExternalSortParams(size_t memory_budget = size_t(1) << 30,
+                                       size_t io_buffer_size = size_t(4) << 20,
+                                       const std::string& temp_directory = "."):
+        memory_budget (memory_budget),
+        io_buffer_size (io_buffer_size),
+        temp_directory (temp_directory)
+
+        {}
+
+    virtual size_t getMemoryBudget() const
+    {
+        return memory_budget;
+    }
+
+    virtual size_t getIoBufferSize() const
+    {
+        return io_buffer_size;
+    }
+
+    virtual std::string getTempDirectory() const
+    {
+        return temp_directory;
+    }
+
+private:
+    size_t memory_budget;
+    size_t io_buffer_size;
+    std::string temp_directory;
+};
+
+//Positional reads and writes of a file; temporary files are deleted when closed
+class ExternalFile
+{
+public:
+    ExternalFile():
+        fd (-1)
+
+        {}
+
+    ~ExternalFile()
+    {
+        close();
+    }
+
+    ExternalFile(const ExternalFile&) = delete;
+    ExternalFile& operator =(const ExternalFile&) = delete;
+
+    void openForReading(const std::string& path)
+    {
+#ifdef _WIN32
+        fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+#endif
+        checkOpened(path);
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    void openForWriting(const std::string& path)
+    {
+#ifdef _WIN32
+        fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        checkOpened(path);
+    }
+
+    void openTemporary(const std::string& directory)
+    {
+        std::string path = directory + "/timsort_runs_XXXXXX";
+#ifdef _WIN32
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        _mktemp_s(name.data(), name.size());
+        path = name.data();
+        fd = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_EXCL | _O_BINARY | _O_TEMPORARY, _S_IREAD | _S_IWRITE);
+        checkOpened(path);
+#else
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        fd = mkstemp(name.data());
+        checkOpened(path);
+        //The file stays reachable through fd only, so it is gone even if the sort is interrupted
+        unlink(name.data());
+#endif
+    }
+
+    long long getSize() const
+    {
+#ifdef _WIN32
+        return _filelengthi64(fd);
+#else
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            throw std::runtime_error("externalTimSort: cannot get file size");
+        return info.st_size;
+#endif
+    }
+
+    //Returns the number of bytes read, less than n_bytes only at the end of the file
+    size_t readAt(void* data, size_t n_bytes, long long offset) const
+    {
+        size_t done = 0;
+        while (done < n_bytes)
+        {
+            long long got = readSome(static_cast<char*>(data) + done, n_bytes - done, offset + done);
+            if (got < 0)
+                throw std::runtime_error("externalTimSort: read failed");
+            if (got == 0)
+                break;
+            done += static_cast<size_t>(got);
+        }
+        return done;
+    }
+
+    //Throws if the file ends before n_bytes are read
+    void readExactly(void* data, size_t n_bytes, long long offset) const
+    {
+        if (readAt(data, n_bytes, offset) != n_bytes)
+            throw std::runtime_error("externalTimSort: file ended before the expected records");
+    }
+
+    void writeAt(const void* data, size_t n_bytes, long long offset) const
+    {
+        size_t done = 0;
+        while (done < n_bytes)
+        {
+            long long put = writeSome(static_cast<const char*>(data) + done, n_bytes - done, offset + done);
+            if (put <= 0)
+                throw std::runtime_error("externalTimSort: write failed");
+            done += static_cast<size_t>(put);
+        }
+    }
+
+    void close()
+    {
+        if (fd < 0)
+            return;
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        fd = -1;
+    }
+
+private:
+    void checkOpened(const std::string& path)
+    {
+        if (fd < 0)
+            throw std::runtime_error("externalTimSort: cannot open " + path);
+    }
+
+    long long readSome(char* data, size_t n_bytes, long long offset) const
+    {
+#ifdef _WIN32
+        if (_lseeki64(fd, offset, SEEK_SET) < 0)
+            return -1;
+        return _read(fd, data, static_cast<unsigned>(std::min<size_t>(n_bytes, 1u << 30)));
+#else
+        return pread(fd, data, n_bytes, offset);
+#endif
+    }
+
+    long long writeSome(const char* data, size_t n_bytes, long long offset) const
+    {
+#ifdef _WIN32
+        if (_lseeki64(fd, offset, SEEK_SET) < 0)
+            return -1;
+        return _write(fd, data, static_cast<unsigned>(std::min<size_t>(n_bytes, 1u << 30)));
+#else
+        return pwrite(fd, data, n_bytes, offset);
+#endif
+    }
+
+    int fd;
+};
+
+//Records [first, first + size) of a file
+struct ExternalRun
+{
+    long long first;
+    long long size;
+};
+
+//Reads one run sequentially through two halves of a buffer of buffer_records: while the records
+//of one are merged, the next part of the run is read into the other by a task of the pool
+template <class Type>
+class ExternalRunReader
+{
+public:
+    //Records are available after the first waitForRecords
+    ExternalRunReader(const ExternalFile& file, ExternalRun run, size_t buffer_records, TimSortThreadPool& pool):
+        file (&file),
+        pool (&pool),
+        next_record (run.first),
+        finish_record (run.first + run.size),
+        buffer (std::max<size_t>(buffer_records / 2, 1)),
+        next_buffer (std::max<size_t>(buffer_records / 2, 1)),
+        position (0),
+        n_buffered (0),
+        n_next_buffered (0)
+    {
+        startRead();
+    }
+
+    ExternalRunReader(ExternalRunReader&&) = default;
+
+    //The pending read writes into next_buffer, so it has to finish first
+    ~ExternalRunReader()
+    {
+        if (pending_read.valid())
+            pending_read.wait();
+    }
+
+    bool isFinished() const
+    {
+        return position == n_buffered;
+    }
+
+    Type& getHead()
+    {
+        return buffer[position];
+    }
+
+    void pop()
+    {
+        position++;
+        if (position == n_buffered)
+            waitForRecords();
+    }
+
+    //Makes the records read in the background current and starts reading the next ones
+    void waitForRecords()
+    {
+        if (pending_read.valid())
+            pending_read.get();
+        buffer.swap(next_buffer);
+        n_buffered = n_next_buffered;
+        position = 0;
+        startRead();
+    }
+
+private:
+    void startRead()
+    {
+        n_next_buffered = static_cast<size_t>(std::min<long long>(next_buffer.size(), finish_record - next_record));
+        if (n_next_buffered == 0)
+            return;
+
+        const ExternalFile* source = file;
+        Type* data = next_buffer.data();
+        size_t n_bytes = n_next_buffered * sizeof(Type);
+        long long offset = next_record * sizeof(Type);
+        pending_read = pool->submit([source, data, n_bytes, offset] { source->readExactly(data, n_bytes, offset); });
+        next_record += n_next_buffered;
+    }
+
+    const ExternalFile* file;
+    TimSortThreadPool* pool;
+    long long next_record;
+    long long finish_record;
+    std::vector<Type> buffer;
+    std::vector<Type> next_buffer;
+    size_t position;
+    size_t n_buffered;
+    size_t n_next_buffered;
+    std::future<void> pending_read;
+};
+
+//Appends records to a file through a buffer of buffer_records
+template <class Type>
+class ExternalRunWriter
+{
+public:
+    ExternalRunWriter(const ExternalFile& file, long long first_record, size_t buffer_records):
+        file (&file),
+        next_record (first_record)
+    {
+        buffer.reserve(buffer_records);
+    }
+
+    void push(const Type& record)
+    {
+        buffer.push_back(record);
+        if (buffer.size() == buffer.capacity())
+            flush();
+    }
+
+    void pushMany(const Type* records, size_t n_records)
+    {
+        flush();
+        file->writeAt(records, n_records * sizeof(Type), next_record * sizeof(Type));
+        next_record += n_records;
+    }
+
+    void flush()
+    {
+        if (buffer.empty())
+            return;
+        file->writeAt(buffer.data(), buffer.size() * sizeof(Type), next_record * sizeof(Type));
+        next_record += buffer.size();
+        buffer.clear();
+    }
+
+    long long getNextRecord() const
+    {
+        return next_record;
+    }
+
+private:
+    const ExternalFile* file;
+    long long next_record;
+    std::vector<Type> buffer;
+};
+
+//Stable k-way merge: on equal records the run going earlier in the file wins
+template <class Type, class Compare>
+void mergeExternalRuns(const ExternalFile& source, const std::vector<ExternalRun>& runs,
+                       ExternalRunWriter<Type>& writer, Compare comp, size_t buffer_records, TimSortThreadPool& pool)
+{
+    //All first reads are queued before waiting for any of them
+    std::vector<ExternalRunReader<Type>> readers;
+    readers.reserve(runs.size());
+    for (size_t i = 0; i < runs.size(); i++)
+        readers.push_back(ExternalRunReader<Type>(source, runs[i], buffer_records, pool));
+    for (size_t i = 0; i < readers.size(); i++)
+        readers[i].waitForRecords();
+
+    //priority_queue keeps the greatest on top, so the order is reversed
+    auto goes_later = [&readers, &comp](size_t a, size_t b) {
+        if (comp(readers[b].getHead(), readers[a].getHead()))
+            return true;
+        return !comp(readers[a].getHead(), readers[b].getHead()) && a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(goes_later)> heads(goes_later);
+    for (size_t i = 0; i < readers.size(); i++)
+    {
+        if (!readers[i].isFinished())
+            heads.push(i);
+    }
+
+    while (!heads.empty())
+    {
+        size_t i = heads.top();
+        heads.pop();
+        writer.push(readers[i].getHead());
+        readers[i].pop();
+        if (!readers[i].isFinished())
+            heads.push(i);
+    }
+    writer.flush();
+}
+
+template <class Type, class Compare = std::less<Type> >
+void externalTimSort(const std::string& input_path, const std::string& output_path,
+                     const IExternalSortParams& params = DefaultExternalSortParams(), Compare comp = Compare())
+{
+    static_assert(std::is_trivially_copyable<Type>::value, "externalTimSort needs trivially copyable records");
+
+    //timSort may take half of the chunk more as its merge buffer
+    size_t chunk_records = std::max<size_t>(params.getMemoryBudget() / sizeof(Type) * 2 / 3, 1);
+    size_t buffer_records = std::max<size_t>(params.getIoBufferSize() / sizeof(Type), 1);
+    size_t max_ways = std::max<size_t>(params.getMemoryBudget() / (buffer_records * sizeof(Type)), 3) - 1;
+
+    ExternalFile input;
+    input.openForReading(input_path);
+    long long n_records = input.getSize() / sizeof(Type);
+    if (input.getSize() % sizeof(Type) != 0)
+        throw std::runtime_error("externalTimSort: file size is not a multiple of the record size");
+
+    //Chunks are sorted into runs of the first temporary file
+    ExternalFile spill[2];
+    spill[0].openTemporary(params.getTempDirectory());
+    std::vector<ExternalRun> runs;
+    {
+        ExternalRunWriter<Type> writer(spill[0], 0, 0);
+        //The greatest record of the previous chunk, kept in the slot after the chunk
+        bool has_last_record = false;
+        size_t chunk_size = static_cast<size_t>(std::min<long long>(chunk_records, n_records));
+        std::vector<Type> chunk(chunk_size + 1);
+        for (long long first = 0; first < n_records; first += chunk_size)
+        {
+            size_t n_chunk = static_cast<size_t>(std::min<long long>(chunk_size, n_records - first));
+            input.readExactly(chunk.data(), n_chunk * sizeof(Type), first * sizeof(Type));
+            timSort(chunk.begin(), chunk.begin() + n_chunk, comp);
+
+            if (has_last_record && !comp(chunk[0], chunk[chunk_size]))
+                runs.back().size += n_chunk;
+            else
+            {
+                ExternalRun run = {first, static_cast<long long>(n_chunk)};
+                runs.push_back(run);
+            }
+
+            chunk[chunk_size] = chunk[n_chunk - 1];
+            has_last_record = true;
+            writer.pushMany(chunk.data(), n_chunk);
+        }
+    }
+    input.close();
+
+    //Passes merge groups of max_ways neighbouring runs, the last one writes the output.
+    //One worker reads ahead for all runs, reads of one file go one after another anyway
+    TimSortThreadPool read_pool(1);
+    int source = 0;
+    while (runs.size() > max_ways)
+    {
+        ExternalFile& target = spill[1 - source];
+        target.close();
+        target.openTemporary(params.getTempDirectory());
+        ExternalRunWriter<Type> writer(target, 0, buffer_records);
+        std::vector<ExternalRun> merged_runs;
+
+        for (size_t i = 0; i < runs.size(); i += max_ways)
+        {
+            std::vector<ExternalRun> group(runs.begin() + i, runs.begin() + std::min(i + max_ways, runs.size()));
+            ExternalRun merged = {writer.getNextRecord(), 0};
+            mergeExternalRuns(spill[source], group, writer, comp, buffer_records, read_pool);
+            merged.size = writer.getNextRecord() - merged.first;
+            merged_runs.push_back(merged);
+        }
+
+        spill[source].close();
+        source = 1 - source;
+        runs.swap(merged_runs);
+    }
+
+    ExternalFile output;
+    output.openForWriting(output_path);
+    ExternalRunWriter<Type> writer(output, 0, buffer_records);
+    mergeExternalRuns(spill[source], runs, writer, comp, buffer_records, read_pool);
+}
@@ -0,0 +1,145 @@
+/*
+FewKeysSort.h
+Sorting of inputs with few distinct keys, like status codes or enum values
+1. Offers timSortFewKeys: distinct keys are collected into a small sorted table in one scan,
+   which also gives every element the number of its key by a branchless binary search.
+   If there are at most MAX_FEW_KEYS distinct keys, elements are distributed stably by counting,
+   at about log2 of the number of keys comparisons per element
+2. When the table overflows the scan stops and timSort sorts the range, whose ascending runs
+   take blocks of equal keys in and whose merges gallop over them
+Distribution needs a copy of the range and one byte per element, elements must be copyable
+*/
+
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "TimSort.h"
+
+//Key numbers are stored in one byte
+const size_t MAX_FEW_KEYS = 64;
+//On shorter inputs timSort is not slower than the scan and the distribution
+const std::ptrdiff_t FEW_KEYS_MIN_SIZE = 1024;
+
+//Number of keys less than value, keys is sorted and not empty
+template <class Type, class Compare>
+size_t findKeyPosition(const std::vector<Type>& keys, const Type& value, Compare comp)
+{
+    const Type* base = keys.data();
+    size_t len = keys.size();
+    while (len > 1)
+    {
+        size_t half = len / 2;
+        //Multiplying by the result keeps compilers from turning the step into a branch
+        base += half * static_cast<size_t>(comp(base[half - 1], value));
+        len -= half;
+    }
+    return (base - keys.data()) + (comp(*base, value) ? 1 : 0);
+}
+
+//Numbers of keys are given in order of appearance and kept when later keys are inserted before them
+template <class RandomAccessIterator, class Compare>
+class FewKeysTable
+{
+public:
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+
+    explicit FewKeysTable(Compare comp):
+        comp (comp)
+
+        {}
+
+    //Number of the key of value, MAX_FEW_KEYS if it is new and the table is full
+    size_t findOrInsert(const ValueType& value)
+    {
+        size_t pos = keys.empty() ? 0 : findKeyPosition(keys, value, comp);
+        if (pos != keys.size() && !comp(value, keys[pos]))
+            return numbers[pos];
+        if (keys.size() == MAX_FEW_KEYS)
+            return MAX_FEW_KEYS;
+
+        keys.insert(keys.begin() + pos, value);
+        numbers.insert(numbers.begin() + pos, static_cast<unsigned char>(keys.size() - 1));
+        return keys.size() - 1;
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+    //Number of the i-th least key
+    size_t getNumber(size_t i) const
+    {
+        return numbers[i];
+    }
+
+private:
+    std::vector<ValueType> keys;
+    std::vector<unsigned char> numbers;
+    Compare comp;
+};
+
+//Moves elements to their key blocks, keeping the order of elements within a block
+template <class RandomAccessIterator, class Compare>
+void distributeByKeys(RandomAccessIterator start, RandomAccessIterator finish,
+                      const FewKeysTable<RandomAccessIterator, Compare>& table,
+                      const std::vector<unsigned char>& key_numbers)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    std::ptrdiff_t arr_size = finish - start;
+
+    std::vector<std::ptrdiff_t> offsets(table.size(), 0);
+    for (std::ptrdiff_t i = 0; i < arr_size; i++)
+        offsets[key_numbers[i]]++;
+
+    std::ptrdiff_t block_start = 0;
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        size_t number = table.getNumber(i);
+        std::ptrdiff_t block_size = offsets[number];
+        offsets[number] = block_start;
+        block_start += block_size;
+    }
+
+    std::vector<ValueType> buffer(std::make_move_iterator(start), std::make_move_iterator(finish));
+    for (std::ptrdiff_t i = 0; i < arr_size; i++)
+        start[offsets[key_numbers[i]]++] = std::move(buffer[i]);
+}
+
+template <class RandomAccessIterator, class Compare>
+void timSortFewKeys(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                    const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    std::ptrdiff_t arr_size = finish - start;
+    if (arr_size < FEW_KEYS_MIN_SIZE)
+    {
+        timSort(start, finish, comp, params);
+        return;
+    }
+
+    FewKeysTable<RandomAccessIterator, Compare> table(comp);
+    std::vector<unsigned char> key_numbers;
+    key_numbers.reserve(arr_size);
+    for (RandomAccessIterator curr = start; curr != finish; ++curr)
+    {
+        size_t number = table.findOrInsert(*curr);
+        if (number == MAX_FEW_KEYS)
+        {
+            timSort(start, finish, comp, params);
+            return;
+        }
+        key_numbers.push_back(static_cast<unsigned char>(number));
+    }
+
+    distributeByKeys(start, finish, table, key_numbers);
+}
+
+template <class RandomAccessIterator>
+void timSortFewKeys(RandomAccessIterator start, RandomAccessIterator finish,
+                    const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    timSortFewKeys(start, finish, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>(), params);
+}
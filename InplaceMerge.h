@@ -1,13 +1,11 @@
 
 #pragma once
-#include <assert.h>
+#include <algorithm>
 #include <cmath>
-#include <vector>
+#include <cstddef>
 #include "Run.h"
 #define Block Run
 
-int min(int a, int b) { return (a < b) ? a : b; }
-
 template <class RandomAccessIterator>
 class BlockCompare
 {
@@ -15,7 +13,7 @@ public:
     template <class Compare>
     bool operator ()(Block<RandomAccessIterator> block1, Block<RandomAccessIterator> block2, Compare comp)
     {
-        if (*block1.start == *block2.start)
+        if (!comp(*block1.start, *block2.start) && !comp(*block2.start, *block1.start))
             return comp(*(block1.start + block1.size - 1), *(block2.start + block2.size - 1));
         else
             return comp(*(block1.start), *(block2.start));
@@ -28,53 +26,140 @@ class BlockSwapper
 public:
     void operator ()(Block<RandomAccessIterator>& block1, Block<RandomAccessIterator>& block2)
     {
-        for (int i = 0; i < min(block1.size, block2.size); i++)
+        for (std::ptrdiff_t i = 0; i < std::min(block1.size, block2.size); i++)
             timSortSwap(*(block1.start + i), *(block2.start + i));
     }
 };
 
-template <class Type>
-class DefaultSwapper
+template <class RandomAccessIterator, class Compare>
+void siftDown(RandomAccessIterator start, std::ptrdiff_t root, std::ptrdiff_t arr_size, Compare comp)
 {
-public:
-    void operator ()(Type& a, Type& b)
+    while (true)
     {
-        Type t = a;
-        a = b;
-        b = t;
+        std::ptrdiff_t child = 2 * root + 1;
+        if (child >= arr_size)
+            return;
+        if (child + 1 < arr_size && comp(*(start + child), *(start + child + 1)))
+            child++;
+        if (!comp(*(start + root), *(start + child)))
+            return;
+
+        timSortSwap(*(start + root), *(start + child));
+        root = child;
     }
-};
+}
 
-template <class RandomAccessIterator, class Compare, class Swapper>
-void selectionSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp, Swapper swapper)
+//Unstable, O(n log n) comparisons and swaps, no extra memory
+template <class RandomAccessIterator, class Compare>
+void heapSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
 {
-    int arr_size = finish - start;
-    
-    for (int i = 0; i < arr_size; i++)
+    std::ptrdiff_t arr_size = finish - start;
+
+    for (std::ptrdiff_t i = arr_size / 2 - 1; i >= 0; i--)
+        siftDown(start, i, arr_size, comp);
+
+    for (std::ptrdiff_t last = arr_size - 1; last > 0; last--)
+    {
+        timSortSwap(*start, *(start + last));
+        siftDown(start, 0, last, comp);
+    }
+}
+
+//Stable rotation-based merge of [start, middle) and [middle, finish) (SymMerge, Kim and Kutzner)
+//O(m log(n / m + 1)) comparisons and O((m + n) log m) moves for runs of sizes m <= n, no extra memory
+template <class RandomAccessIterator, class Compare>
+void symMerge(RandomAccessIterator start, RandomAccessIterator middle, RandomAccessIterator finish, Compare comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+
+    while (start != middle && middle != finish)
     {
-        RandomAccessIterator min_iter = start + i;
-        
-        for (RandomAccessIterator iter = start + i + 1; iter != finish; iter++)
+        if (middle - start == 1)
         {
-            if (comp(*iter, *min_iter))
-                min_iter = iter;
+            //The only left element goes before the first right element not less than it
+            RandomAccessIterator low = middle, high = finish;
+            while (low < high)
+            {
+                RandomAccessIterator med = low + (high - low) / 2;
+                if (comp(*med, *start))
+                    low = med + 1;
+                else
+                    high = med;
+            }
+
+            ValueType tmp = std::move(*start);
+            std::move(middle, low, start);
+            *(low - 1) = std::move(tmp);
+            return;
         }
 
-        swapper(*(start + i), *min_iter);
+        if (finish - middle == 1)
+        {
+            //The only right element goes after all left elements not greater than it
+            RandomAccessIterator low = start, high = middle;
+            while (low < high)
+            {
+                RandomAccessIterator med = low + (high - low) / 2;
+                if (!comp(*middle, *med))
+                    low = med + 1;
+                else
+                    high = med;
+            }
+
+            ValueType tmp = std::move(*middle);
+            std::move_backward(low, middle, finish);
+            *low = std::move(tmp);
+            return;
+        }
+
+        //Split both runs symmetrically around the center of the range
+        std::ptrdiff_t left_size = middle - start;
+        std::ptrdiff_t half = (finish - start) / 2;
+        std::ptrdiff_t sum = half + left_size;
+        std::ptrdiff_t low = (left_size > half) ? sum - (finish - start) : 0;
+        std::ptrdiff_t high = (left_size > half) ? half : left_size;
+        while (low < high)
+        {
+            std::ptrdiff_t med = low + (high - low) / 2;
+            if (!comp(*(start + (sum - med - 1)), *(start + med)))
+                low = med + 1;
+            else
+                high = med;
+        }
+
+        RandomAccessIterator split_left = start + low;
+        RandomAccessIterator split_right = start + (sum - low);
+        RandomAccessIterator center = start + half;
+        if (split_left != middle && middle != split_right)
+            std::rotate(split_left, middle, split_right);
+
+        //Recurse into the smaller part, loop on the larger one
+        if (center - start < finish - center)
+        {
+            symMerge(start, split_left, center, comp);
+            start = center;
+            middle = split_right;
+        }
+        else
+        {
+            symMerge(center, split_right, finish, comp);
+            finish = center;
+            middle = split_left;
+        }
     }
 }
 
 template <class RandomAccessIterator>
-void getBlockForward(RandomAccessIterator start, int i, int block_len, 
-                     Block<RandomAccessIterator>& block, int arr_size)
+void getBlockForward(RandomAccessIterator start, std::ptrdiff_t i, std::ptrdiff_t block_len, 
+                     Block<RandomAccessIterator>& block, std::ptrdiff_t arr_size)
 {
     block.start = start + block_len * i;
-    block.size = min(block_len, arr_size - block_len * i);
+    block.size = std::min(block_len, arr_size - block_len * i);
 }
 
 template <class RandomAccessIterator>
-void getBlockBackward(RandomAccessIterator finish, int i, int block_len,
-                      Block<RandomAccessIterator>& block, int arr_size)
+void getBlockBackward(RandomAccessIterator finish, std::ptrdiff_t i, std::ptrdiff_t block_len,
+                      Block<RandomAccessIterator>& block, std::ptrdiff_t arr_size)
 {
     if ((i + 1) * block_len <= arr_size)
     {
@@ -88,82 +173,70 @@ void getBlockBackward(RandomAccessIterator finish, int i, int block_len,
     }
 }
 
-template <class RandomAccessIterator>
-void divideArrayToBlocks(RandomAccessIterator start, RandomAccessIterator finish,
-                         std::vector<Block<RandomAccessIterator>>& blocks)
+template <class RandomAccessIterator, class CompareBlock, class CompareElem, class Swapper>
+void siftDownBlocks(RandomAccessIterator start, std::ptrdiff_t arr_size, std::ptrdiff_t block_len, std::ptrdiff_t root,
+                    std::ptrdiff_t n_blocks, CompareBlock comp_block, CompareElem comp_elem, Swapper swap)
 {
-    int arr_size = finish - start;
-    int block_len = static_cast<int>(sqrt(arr_size));
-
-    int block_start_index = 0;
-    while (block_start_index + block_len <= arr_size)
+    while (true)
     {
-        Block<RandomAccessIterator> new_block = {start + block_start_index, block_len};
-        block_start_index += block_len;
-        blocks.push_back(new_block);
-    }
-
-    Block<RandomAccessIterator> last_block = {start + block_start_index, arr_size - block_start_index};
-    blocks.push_back(last_block);
-}
-
-template <class RandomAccessIterator>
-void divideArrayToBlocksFromEnd(RandomAccessIterator start, RandomAccessIterator finish,
-                                std::vector<Block<RandomAccessIterator>>& blocks, int block_len)
-{
-    int arr_size = finish - start;
+        std::ptrdiff_t child = 2 * root + 1;
+        if (child >= n_blocks)
+            return;
+
+        Block<RandomAccessIterator> root_block, child_block, sibling_block;
+        getBlockForward(start, root, block_len, root_block, arr_size);
+        getBlockForward(start, child, block_len, child_block, arr_size);
+        if (child + 1 < n_blocks)
+        {
+            getBlockForward(start, child + 1, block_len, sibling_block, arr_size);
+            if (comp_block(child_block, sibling_block, comp_elem))
+            {
+                child++;
+                child_block = sibling_block;
+            }
+        }
+        if (!comp_block(root_block, child_block, comp_elem))
+            return;
 
-    int block_finish_index = arr_size;
-    while (block_finish_index - block_len >= 0)
-    {
-        Block<RandomAccessIterator> new_block = {start + block_finish_index - block_len, block_len};
-        block_finish_index -= block_len;
-        blocks.push_back(new_block);
+        swap(root_block, child_block);
+        root = child;
     }
-
-    Block<RandomAccessIterator> last_block = {start, block_finish_index};
-    blocks.push_back(last_block);
 }
 
+//Heap sort of the blocks as of elements: O(k log k) block comparisons and swaps, no extra memory
 template <class RandomAccessIterator, class CompareBlock, class CompareElem, class Swapper>
-void sortBlocks(RandomAccessIterator start, int arr_size, int block_len, int n_blocks,
+void sortBlocks(RandomAccessIterator start, std::ptrdiff_t arr_size, std::ptrdiff_t block_len, std::ptrdiff_t n_blocks,
                 CompareBlock comp_block, CompareElem comp_elem, Swapper swap)
 {
-    for (int i = 0; i < n_blocks - 1; i++)
-    {
-        Block<RandomAccessIterator> min_block;
-        getBlockForward(start, i, block_len, min_block, arr_size);
-        Block<RandomAccessIterator> dest = min_block;
+    for (std::ptrdiff_t i = n_blocks / 2 - 1; i >= 0; i--)
+        siftDownBlocks(start, arr_size, block_len, i, n_blocks, comp_block, comp_elem, swap);
 
-        for (int j = i + 1; j < n_blocks; j++)
-        {
-            Block<RandomAccessIterator> new_block;
-            getBlockForward(start, j, block_len, new_block, arr_size);
-
-            if (comp_block(new_block, min_block, comp_elem))
-                min_block = new_block;
-        }
-
-        swap(dest, min_block);
+    for (std::ptrdiff_t last = n_blocks - 1; last > 0; last--)
+    {
+        Block<RandomAccessIterator> first_block, last_block;
+        getBlockForward(start, 0, block_len, first_block, arr_size);
+        getBlockForward(start, last, block_len, last_block, arr_size);
+        swap(first_block, last_block);
+        siftDownBlocks(start, arr_size, block_len, 0, last, comp_block, comp_elem, swap);
     }
 }
 
 template <class RandomAccessIterator, class Compare>
 void inplaceMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp, int gallop = NO_GALLOPING_MODE)
 {
-    int arr_size = left.size + right.size;
-    int forward_len = static_cast<int>(sqrt(arr_size));
-    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
-    int min_len = 4 * forward_len;
-    if (arr_size <= min_len)
+    std::ptrdiff_t arr_size = left.size + right.size;
+    std::ptrdiff_t forward_len = static_cast<std::ptrdiff_t>(sqrt(static_cast<double>(arr_size)));
+    std::ptrdiff_t min_len = 4 * forward_len;
+    //Short or asymmetric merges are cheaper with rotations, and those stay stable
+    if (arr_size <= min_len || std::min(left.size, right.size) <= forward_len)
     {
-        selectionSort(left.start, right.start + right.size, comp, DefaultSwapper<ValueType>());
+        symMerge(left.start, right.start, right.start + right.size, comp);
         return;
     }
 
     BlockSwapper<RandomAccessIterator> block_swapper;
 
-    int middle_block_index = 0;
+    std::ptrdiff_t middle_block_index = 0;
 
     while (true)
     {
@@ -176,7 +249,7 @@ void inplaceMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> righ
             break;
     }
 
-    int n_blocks_forward = arr_size / forward_len + 1;
+    std::ptrdiff_t n_blocks_forward = arr_size / forward_len + 1;
     Block<RandomAccessIterator> remained, buffer, middle;
     getBlockForward(left.start, n_blocks_forward - 1, forward_len, remained, arr_size);
     getBlockForward(left.start, n_blocks_forward - 2, forward_len, buffer, arr_size);
@@ -187,7 +260,7 @@ void inplaceMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> righ
     sortBlocks(left.start, arr_size, forward_len, n_blocks_forward - 2, 
                BlockCompare<RandomAccessIterator>(), comp, block_swapper);
 
-    for (int i = 0; i + 1 < n_blocks_forward - 2; i++)
+    for (std::ptrdiff_t i = 0; i + 1 < n_blocks_forward - 2; i++)
     {
         Block<RandomAccessIterator> left_block, right_block;
         getBlockForward(left.start, i, forward_len, left_block, arr_size);
@@ -197,13 +270,13 @@ void inplaceMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> righ
     }
 
     RandomAccessIterator finish = right.start + right.size;
-    int backward_len = buffer.size + remained.size;
+    std::ptrdiff_t backward_len = buffer.size + remained.size;
 
-    selectionSort(finish - 2 * backward_len, finish, comp, DefaultSwapper<ValueType>());
+    heapSort(finish - 2 * backward_len, finish, comp);
     
-    int n_backward = (arr_size - backward_len) / backward_len + 1;
+    std::ptrdiff_t n_backward = (arr_size - backward_len) / backward_len + 1;
 
-    for (int i = 0; i + 1 < n_backward; i++)
+    for (std::ptrdiff_t i = 0; i + 1 < n_backward; i++)
     {
         Block<RandomAccessIterator> left_block, right_block;
         getBlockBackward(finish - backward_len, i + 1, backward_len, left_block, arr_size - backward_len);
@@ -212,5 +285,5 @@ void inplaceMerge(Run<RandomAccessIterator> left, Run<RandomAccessIterator> righ
         mergeRunsWithBuffer(left_block, right_block, finish - backward_len, comp, WM_SWAP_WRITE, gallop);
     }
 
-    selectionSort(finish - backward_len, finish, comp, DefaultSwapper<ValueType>());
+    heapSort(finish - backward_len, finish, comp);
 } 
\ No newline at end of file
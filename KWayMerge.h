@@ -0,0 +1,251 @@
+/*
+KWayMerge.h
+Stable merging of many sorted sequences
+1. Offers template class LoserTree keeping the heads of K sorted sources, the next element
+   is found by log K branchless matches; on equality the source with the lower index goes first.
+   An exhausted source loses every later match, so it costs one replay of log K matches
+2. Offers kWayMerge copying K sorted sources into a destination range: when one source wins
+   MIN_KWAY_GALLOP times in a row, its block preceding the runner-up is found by gallopLeft
+   or gallopRight and copied at once. Arithmetic types with std::less or std::greater
+   are copied and merged in the destination by the merge engine instead
+3. Offers kWayMergeInplace for adjacent sorted segments of one range: segments are pushed
+   as runs to the merge engine of timSort, no run detection is done
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "TimSort.h"
+
+const int MIN_KWAY_GALLOP = 7;
+
+//Exhausted sources are replaced by the index getSourcesNumber(), which loses every match,
+//so indices of sources never change
+template <class RandomAccessIterator, class Compare>
+class LoserTree
+{
+public:
+    LoserTree(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& sources, Compare comp):
+        comp (comp)
+    {
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            if (sources[i].first == sources[i].second)
+                continue;
+            heads.push_back(sources[i].first);
+            finishes.push_back(sources[i].second);
+        }
+        build();
+    }
+
+    bool isFinished() const
+    {
+        return winner == heads.size();
+    }
+
+    size_t getSourcesNumber() const
+    {
+        return heads.size();
+    }
+
+    size_t getWinner() const
+    {
+        return winner;
+    }
+
+    RandomAccessIterator& getHead(size_t i)
+    {
+        return heads[i];
+    }
+
+    RandomAccessIterator getFinish(size_t i) const
+    {
+        return finishes[i];
+    }
+
+    //Plays the matches of the winner again after its head moved, an exhausted winner is replaced by the sentinel
+    void replay()
+    {
+        size_t curr = (heads[winner] == finishes[winner]) ? heads.size() : winner;
+        for (size_t node = (winner + heads.size()) / 2; node >= 1; node /= 2)
+        {
+            size_t loser = losers[node];
+            bool loser_wins = precedes(loser, curr);
+            losers[node] = loser_wins ? curr : loser;
+            curr = loser_wins ? loser : curr;
+        }
+        winner = curr;
+    }
+
+    //The source which would win if the winner were removed, getSourcesNumber() if there is none
+    size_t getRunnerUp() const
+    {
+        size_t runner_up = heads.size();
+        for (size_t node = (winner + heads.size()) / 2; node >= 1; node /= 2)
+        {
+            if (precedes(losers[node], runner_up))
+                runner_up = losers[node];
+        }
+        return runner_up;
+    }
+
+    //True if the head of source a goes before the head of source b, the sentinel goes after all
+    bool precedes(size_t a, size_t b) const
+    {
+        size_t sentinel = heads.size();
+        if (a == sentinel || b == sentinel)
+            return b == sentinel && a != sentinel;
+
+        //One comparison of operands chosen without branches: the lower index wins unless it is greater
+        bool a_is_lower = a < b;
+        size_t lower = a_is_lower ? a : b, upper = a_is_lower ? b : a;
+        return comp(*heads[upper], *heads[lower]) != a_is_lower;
+    }
+
+private:
+    //Leaves are nodes n..2n - 1 for n sources, node i has children 2i and 2i + 1
+    void build()
+    {
+        size_t n_sources = heads.size();
+        winner = 0;
+        if (n_sources < 2)
+            return;
+
+        losers.resize(n_sources);
+        std::vector<size_t> winners(2 * n_sources);
+        for (size_t i = 0; i < n_sources; i++)
+            winners[n_sources + i] = i;
+        for (size_t node = n_sources - 1; node >= 1; node--)
+        {
+            size_t left = winners[2 * node], right = winners[2 * node + 1];
+            bool left_wins = precedes(left, right);
+            winners[node] = left_wins ? left : right;
+            losers[node] = left_wins ? right : left;
+        }
+        winner = winners[1];
+    }
+
+    std::vector<RandomAccessIterator> heads;
+    std::vector<RandomAccessIterator> finishes;
+    std::vector<size_t> losers;
+    size_t winner;
+    mutable Compare comp;
+};
+
+template <class RandomAccessIterator, class OutputIterator, class Compare>
+OutputIterator kWayMergeImpl(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& sources,
+                             OutputIterator dest, Compare comp, std::false_type)
+{
+    LoserTree<RandomAccessIterator, Compare> tree(sources, comp);
+    size_t last_winner = tree.getSourcesNumber();
+    int n_wins = 0;
+
+    while (!tree.isFinished())
+    {
+        size_t curr = tree.getWinner();
+        RandomAccessIterator& head = tree.getHead(curr);
+        n_wins = (curr == last_winner) ? n_wins + 1 : 1;
+        last_winner = curr;
+
+        if (n_wins < MIN_KWAY_GALLOP)
+        {
+            *(dest++) = *(head++);
+            tree.replay();
+            continue;
+        }
+
+        //Galloping: everything before the head of the runner-up is copied at once
+        size_t runner_up = tree.getRunnerUp();
+        std::ptrdiff_t len = tree.getFinish(curr) - head;
+        std::ptrdiff_t block = len;
+        if (runner_up != tree.getSourcesNumber())
+        {
+            RandomAccessIterator key = tree.getHead(runner_up);
+            block = (curr < runner_up) ? gallopRight(key, head, len, 0, comp) : gallopLeft(key, head, len, 0, comp);
+        }
+
+        dest = std::copy(head, head + block, dest);
+        head += block;
+        if (block < MIN_KWAY_GALLOP)
+            n_wins = 0;
+        tree.replay();
+    }
+
+    return dest;
+}
+
+template <class RandomAccessIterator, class Merger>
+void pushSegments(RandomAccessIterator start, const std::vector<std::ptrdiff_t>& offsets, Merger& merger)
+{
+    for (size_t i = 0; i + 1 < offsets.size(); i++)
+    {
+        if (offsets[i + 1] == offsets[i])
+            continue;
+        Run<RandomAccessIterator> run = {start + offsets[i], offsets[i + 1] - offsets[i]};
+        merger.pushRun(run);
+    }
+}
+
+//Sorted segments [start + offsets[i], start + offsets[i + 1]) are merged in place, using
+//the merge buffer budget, galloping and the merge order of params
+template <class RandomAccessIterator, class Compare>
+void kWayMergeInplace(RandomAccessIterator start, const std::vector<std::ptrdiff_t>& offsets, Compare comp,
+                      const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    if (offsets.size() < 2)
+        return;
+
+    RandomAccessIterator first = start + offsets.front(), finish = start + offsets.back();
+    NoTimSortStats stats;
+    MergeState<RandomAccessIterator> merge_state(params.getMergeBufferBudget(), finish - first,
+                                                 params.getGallop(), stats);
+
+    if (params.getMergeStrategy() == MS_POWERSORT)
+    {
+        PowersortMerger<RandomAccessIterator, Compare, NoTimSortStats> merger(first, finish, comp, merge_state);
+        pushSegments(start, offsets, merger);
+        merger.mergeAll();
+    }
+    else
+    {
+        RunStackMerger<RandomAccessIterator, Compare, ITimSortParams, NoTimSortStats> merger(comp, params, merge_state);
+        pushSegments(start, offsets, merger);
+        merger.mergeAll();
+    }
+}
+
+//Arithmetic sources are copied to dest one after another and merged there by the SimdMerge.h kernels,
+//which is faster than the loser tree for them
+template <class RandomAccessIterator, class OutputIterator, class Compare>
+OutputIterator kWayMergeImpl(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& sources,
+                             OutputIterator dest, Compare comp, std::true_type)
+{
+    std::vector<std::ptrdiff_t> offsets(1, 0);
+    OutputIterator dest_finish = dest;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        dest_finish = std::copy(sources[i].first, sources[i].second, dest_finish);
+        offsets.push_back(dest_finish - dest);
+    }
+
+    kWayMergeInplace(dest, offsets, comp);
+    return dest_finish;
+}
+
+//Copies the stable merge of sorted sources to dest, returns the end of the output.
+//Small trivially copyable records stay on the loser tree: merging their concatenation in place is
+//about a third faster when sources interleave randomly, but several times slower when they take
+//turns in long blocks, which the tree copies at once
+template <class RandomAccessIterator, class OutputIterator, class Compare>
+OutputIterator kWayMerge(const std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& sources,
+                         OutputIterator dest, Compare comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    const bool USE_MERGE_ENGINE = IsBranchlessMergeable<ValueType, Compare>::value &&
+        std::is_same<typename std::iterator_traits<OutputIterator>::iterator_category, std::random_access_iterator_tag>::value;
+    return kWayMergeImpl(sources, dest, comp, std::integral_constant<bool, USE_MERGE_ENGINE>());
+}
@@ -0,0 +1,176 @@
+/*
+KeySort.h
+Sorting records by keys extracted from them
+1. Offers timSortByKey: keys are taken from every record once and sorted together with record
+   indices in a compact array (decorate-sort-undecorate), so runs, galloping and merges
+   touch only keys; records are moved once, when the sorted order is known
+2. Offers timArgSort: the stable sorting permutation of a range, which is left in place.
+   Indices are sorted instead of elements, 32-bit ones whenever the range is shorter than 2^32,
+   and runs of the elements are found as in timSort
+3. Offers applyPermutation, moving records along the cycles of a permutation in one pass,
+   so one permutation may be applied to several parallel arrays
+Equal keys keep the order of their records
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "TimSort.h"
+
+template <class Key, class Index>
+struct KeyedIndex
+{
+    Key key;
+    Index index;
+};
+
+template <class Key, class Index, class Compare>
+class CompareKeyedIndex
+{
+public:
+    explicit CompareKeyedIndex(Compare comp):
+        comp (comp)
+
+        {}
+
+    bool operator ()(const KeyedIndex<Key, Index>& a, const KeyedIndex<Key, Index>& b)
+    {
+        return comp(a.key, b.key);
+    }
+
+private:
+    Compare comp;
+};
+
+//Afterwards position i holds the record which was at position permutation[i]
+template <class RandomAccessIterator, class Index>
+void applyPermutation(RandomAccessIterator start, const std::vector<Index>& permutation)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type Type;
+
+    std::vector<bool> placed(permutation.size(), false);
+    for (size_t i = 0; i < permutation.size(); i++)
+    {
+        if (placed[i] || permutation[i] == static_cast<Index>(i))
+            continue;
+
+        Type cycle_start = std::move(start[i]);
+        size_t j = i;
+        while (static_cast<size_t>(permutation[j]) != i)
+        {
+            size_t source = permutation[j];
+            start[j] = std::move(start[source]);
+            placed[j] = true;
+            j = source;
+        }
+        start[j] = std::move(cycle_start);
+        placed[j] = true;
+    }
+}
+
+//Compares indices by the elements they point to
+template <class RandomAccessIterator, class Compare>
+class CompareIndirect
+{
+public:
+    CompareIndirect(RandomAccessIterator start, Compare comp):
+        start (start),
+        comp (comp)
+
+        {}
+
+    template <class Index>
+    bool operator ()(Index a, Index b)
+    {
+        return comp(start[a], start[b]);
+    }
+
+private:
+    RandomAccessIterator start;
+    Compare comp;
+};
+
+template <class Index, class RandomAccessIterator, class Compare>
+void sortIndices(RandomAccessIterator start, std::vector<Index>& permutation, Compare comp, const ITimSortParams& params)
+{
+    for (size_t i = 0; i < permutation.size(); i++)
+        permutation[i] = static_cast<Index>(i);
+    timSort(permutation.begin(), permutation.end(), CompareIndirect<RandomAccessIterator, Compare>(start, comp), params);
+}
+
+//permutation[i] becomes the position of the element which goes i-th in stable sorted order,
+//the range itself is not changed
+template <class Index, class RandomAccessIterator, class Compare>
+void timArgSort(RandomAccessIterator start, RandomAccessIterator finish, std::vector<Index>& permutation,
+                Compare comp, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    std::ptrdiff_t arr_size = finish - start;
+    if (arr_size > 0 &&
+        static_cast<unsigned long long>(arr_size - 1) > static_cast<unsigned long long>(std::numeric_limits<Index>::max()))
+        throw std::length_error("timArgSort: index type is too narrow for the range");
+
+    permutation.resize(arr_size);
+    if (sizeof(Index) > sizeof(std::uint32_t) &&
+        static_cast<unsigned long long>(arr_size) <= std::numeric_limits<std::uint32_t>::max())
+    {
+        //Moving narrow indices halves the memory traffic of merges
+        std::vector<std::uint32_t> narrow_permutation(arr_size);
+        sortIndices(start, narrow_permutation, comp, params);
+        for (std::ptrdiff_t i = 0; i < arr_size; i++)
+            permutation[i] = static_cast<Index>(narrow_permutation[i]);
+    }
+    else
+        sortIndices(start, permutation, comp, params);
+}
+
+template <class Index, class RandomAccessIterator>
+void timArgSort(RandomAccessIterator start, RandomAccessIterator finish, std::vector<Index>& permutation)
+{
+    timArgSort(start, finish, permutation,
+               std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+//Orders records so that comp(projection(a), projection(b)) holds for each a before b.
+//projection is called once per record, Key is what it returns
+template <class RandomAccessIterator, class Projection, class Compare>
+void timSortByKey(RandomAccessIterator start, RandomAccessIterator finish, Projection projection,
+                  Compare comp, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    typedef typename std::decay<decltype(projection(*start))>::type Key;
+    typedef KeyedIndex<Key, std::ptrdiff_t> Keyed;
+
+    std::ptrdiff_t arr_size = finish - start;
+    if (arr_size < 2)
+        return;
+
+    std::vector<Keyed> keys;
+    keys.reserve(arr_size);
+    for (std::ptrdiff_t i = 0; i < arr_size; i++)
+    {
+        Keyed keyed = {projection(start[i]), i};
+        keys.push_back(std::move(keyed));
+    }
+
+    timSort(keys.begin(), keys.end(), CompareKeyedIndex<Key, std::ptrdiff_t, Compare>(comp), params);
+
+    std::vector<std::ptrdiff_t> permutation(arr_size);
+    for (std::ptrdiff_t i = 0; i < arr_size; i++)
+        permutation[i] = keys[i].index;
+    std::vector<Keyed>().swap(keys);
+
+    applyPermutation(start, permutation);
+}
+
+template <class RandomAccessIterator, class Projection>
+void timSortByKey(RandomAccessIterator start, RandomAccessIterator finish, Projection projection)
+{
+    typedef typename std::decay<decltype(projection(*start))>::type Key;
+    timSortByKey(start, finish, projection, std::less<Key>());
+}
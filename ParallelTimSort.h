@@ -0,0 +1,485 @@
+/*
+ParallelTimSort.h
+Multi-threaded TimSort
+1. Offers class TimSortThreadPool: a fixed set of worker threads executing submitted tasks
+2. Offers findCoRank which splits a stable merge of two runs into independent parts
+3. Offers parallelTimSort: chunks are sorted concurrently (run detection included),
+   then merged in rounds between the array and a buffer, every merge split into parts for all threads.
+   Elements already in place at the ends of two chunks are moved without comparisons.
+   The buffer is uninitialized memory for a copy of the array. When the merge buffer budget of params
+   is smaller, even by one element, sorted chunks are merged by the sequential merge engine instead:
+   only the chunk sorts run in parallel then, a budget of half the array gives no parallel merging
+Output is the same as the output of sequential timSort
+*/
+
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "TimSort.h"
+#include "KWayMerge.h"
+
+const int MIN_PARALLEL_LENGTH = 1 << 13;
+
+class TimSortThreadPool
+{
+public:
+    explicit TimSortThreadPool(int n_threads = std::thread::hardware_concurrency()):
+        stopping (false)
+    {
+        n_threads = std::max(n_threads, 1);
+        for (int i = 0; i < n_threads; i++)
+            workers.push_back(std::thread(&TimSortThreadPool::workerLoop, this));
+    }
+
+    ~TimSortThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        has_task.notify_all();
+
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    TimSortThreadPool(const TimSortThreadPool&) = delete;
+    TimSortThreadPool& operator =(const TimSortThreadPool&) = delete;
+
+    int getThreadsNumber() const
+    {
+        return static_cast<int>(workers.size());
+    }
+
+    std::future<void> submit(std::function<void()> task)
+    {
+        std::packaged_task<void()> packaged(task);
+        std::future<void> result = packaged.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push(std::move(packaged));
+        }
+        has_task.notify_one();
+        return result;
+    }
+
+private:
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                has_task.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable has_task;
+    bool stopping;
+};
+
+//Waits for all tasks, then passes the first exception thrown by them to the caller
+inline void waitAll(std::vector<std::future<void>>& futures)
+{
+    for (size_t i = 0; i < futures.size(); i++)
+        futures[i].wait();
+
+    std::vector<std::future<void>> finished;
+    finished.swap(futures);
+    for (size_t i = 0; i < finished.size(); i++)
+        finished[i].get();
+}
+
+//Number of left run elements among the first out_index elements of the stable merge
+template <class LeftIterator, class RightIterator, class Compare>
+std::ptrdiff_t findCoRank(std::ptrdiff_t out_index, LeftIterator left, std::ptrdiff_t left_size,
+                          RightIterator right, std::ptrdiff_t right_size, Compare comp)
+{
+    std::ptrdiff_t low = std::max<std::ptrdiff_t>(0, out_index - right_size);
+    std::ptrdiff_t high = std::min(out_index, left_size);
+
+    while (low < high)
+    {
+        std::ptrdiff_t med = low + (high - low) / 2;
+        //Left element goes first on equality
+        if (!comp(right[out_index - med - 1], left[med]))
+            low = med + 1;
+        else
+            high = med;
+    }
+
+    return low;
+}
+
+//Writes by move assignment, or by move construction when the destination is uninitialized memory
+template <bool Construct>
+struct MoveWriter
+{
+    template <class DestIterator, class Type>
+    static void write(DestIterator dest, Type& value)
+    {
+        *dest = std::move(value);
+    }
+};
+
+template <>
+struct MoveWriter<true>
+{
+    template <class DestIterator, class Type>
+    static void write(DestIterator dest, Type& value)
+    {
+        ::new (static_cast<void*>(&*dest)) Type(std::move(value));
+    }
+};
+
+//dest is advanced past the written elements, so a failed part knows what it has constructed
+template <bool Construct, class SourceIterator, class DestIterator>
+void moveInto(SourceIterator first, SourceIterator last, DestIterator& dest)
+{
+    for (; first != last; ++first, ++dest)
+        MoveWriter<Construct>::write(dest, *first);
+}
+
+template <bool Construct, class SourceIterator, class DestIterator, class Compare>
+void mergeMoveInto(SourceIterator left, SourceIterator left_finish,
+                   SourceIterator right, SourceIterator right_finish,
+                   DestIterator& dest, Compare comp)
+{
+    while (left != left_finish && right != right_finish)
+    {
+        if (comp(*right, *left))
+            MoveWriter<Construct>::write(dest, *(right++));
+        else
+            MoveWriter<Construct>::write(dest, *(left++));
+        ++dest;
+    }
+
+    moveInto<Construct>(left, left_finish, dest);
+    moveInto<Construct>(right, right_finish, dest);
+}
+
+//Two sorted chunks: the first prefix_size elements of left go first and the elements of right
+//after middle.size stay last, only the rest of left and the first middle.size of right are merged
+template <class SourceIterator>
+struct ChunkPair
+{
+    SourceIterator left;
+    std::ptrdiff_t left_size;
+    SourceIterator right;
+    std::ptrdiff_t right_size;
+    std::ptrdiff_t prefix_size;
+    std::ptrdiff_t middle_right_size;
+};
+
+template <class SourceIterator, class Compare>
+ChunkPair<SourceIterator> trimChunkPair(SourceIterator left, std::ptrdiff_t left_size,
+                                        SourceIterator right, std::ptrdiff_t right_size, Compare comp)
+{
+    ChunkPair<SourceIterator> pair = {left, left_size, right, right_size, left_size, 0};
+    Run<SourceIterator> left_run = {left, left_size};
+    Run<SourceIterator> right_run = {right, right_size};
+    //When nothing is left to merge the chunks are in order
+    if (trimRunsForMerge(left_run, right_run, comp))
+    {
+        pair.prefix_size = left_run.start - left;
+        pair.middle_right_size = right_run.size;
+    }
+    return pair;
+}
+
+//Writes the elements [out_start, out_finish) of the stable merge of the pair
+template <bool Construct, class SourceIterator, class DestIterator, class Compare>
+void mergeChunkPairPart(const ChunkPair<SourceIterator>& pair, std::ptrdiff_t out_start, std::ptrdiff_t out_finish,
+                        DestIterator& dest, Compare comp)
+{
+    std::ptrdiff_t middle_start = pair.prefix_size;
+    std::ptrdiff_t middle_finish = pair.left_size + pair.middle_right_size;
+
+    if (out_start < middle_start)
+        moveInto<Construct>(pair.left + out_start, pair.left + std::min(out_finish, middle_start), dest);
+
+    std::ptrdiff_t part_start = std::max(out_start, middle_start) - middle_start;
+    std::ptrdiff_t part_finish = std::min(out_finish, middle_finish) - middle_start;
+    if (part_start < part_finish)
+    {
+        SourceIterator middle_left = pair.left + pair.prefix_size;
+        std::ptrdiff_t middle_left_size = pair.left_size - pair.prefix_size;
+        std::ptrdiff_t left_start = findCoRank(part_start, middle_left, middle_left_size,
+                                               pair.right, pair.middle_right_size, comp);
+        std::ptrdiff_t left_finish = findCoRank(part_finish, middle_left, middle_left_size,
+                                                pair.right, pair.middle_right_size, comp);
+        mergeMoveInto<Construct>(middle_left + left_start, middle_left + left_finish,
+                                 pair.right + (part_start - left_start), pair.right + (part_finish - left_finish),
+                                 dest, comp);
+    }
+
+    if (out_finish > middle_finish)
+        moveInto<Construct>(pair.right + (std::max(out_start, middle_finish) - pair.left_size),
+                            pair.right + (out_finish - pair.left_size), dest);
+}
+
+//Destroys [first, last) when it was constructed in uninitialized memory
+template <bool Construct, class DestIterator>
+void destroyConstructed(DestIterator first, DestIterator last)
+{
+    typedef typename std::iterator_traits<DestIterator>::value_type Type;
+    for (; Construct && first != last; ++first)
+        (*first).~Type();
+}
+
+//Waits for tasks which construct [out_start, out_finish) ranges of dest. If any of them failed,
+//the ranges of the others are destroyed, a failed task destroys its own elements
+template <class Type>
+void waitAllConstructing(std::vector<std::future<void>>& futures,
+                         const std::vector<std::pair<std::ptrdiff_t, std::ptrdiff_t>>& ranges, Type* dest)
+{
+    for (size_t i = 0; i < futures.size(); i++)
+        futures[i].wait();
+
+    std::exception_ptr error;
+    std::vector<bool> failed(futures.size(), false);
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        try
+        {
+            futures[i].get();
+        }
+        catch (...)
+        {
+            failed[i] = true;
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    futures.clear();
+
+    if (!error)
+        return;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        for (std::ptrdiff_t j = ranges[i].first; !failed[i] && j < ranges[i].second; j++)
+            dest[j].~Type();
+    }
+    std::rethrow_exception(error);
+}
+
+template <class DestIterator>
+void waitRound(std::vector<std::future<void>>& futures, const std::vector<std::pair<std::ptrdiff_t, std::ptrdiff_t>>&,
+               DestIterator, std::false_type)
+{
+    waitAll(futures);
+}
+
+template <class Type>
+void waitRound(std::vector<std::future<void>>& futures, const std::vector<std::pair<std::ptrdiff_t, std::ptrdiff_t>>& ranges,
+               Type* dest, std::true_type)
+{
+    waitAllConstructing(futures, ranges, dest);
+}
+
+//Merges neighbouring pairs of sorted chunks from source to dest, bounds are updated to the merged chunks.
+//With Construct dest is uninitialized memory, which is filled completely
+template <bool Construct, class SourceIterator, class DestIterator, class Compare>
+void mergeChunksRound(SourceIterator source, DestIterator dest, std::vector<std::ptrdiff_t>& bounds,
+                      Compare comp, TimSortThreadPool& pool)
+{
+    std::ptrdiff_t arr_size = bounds.back();
+    int n_threads = pool.getThreadsNumber();
+    std::vector<std::ptrdiff_t> new_bounds;
+    std::vector<std::future<void>> futures;
+    std::vector<std::pair<std::ptrdiff_t, std::ptrdiff_t>> ranges;
+
+    //All pairs are trimmed before the first task starts, so an exception of comp here leaves nothing running.
+    //A chunk without a pair is moved as a pair with an empty right chunk
+    std::vector<ChunkPair<SourceIterator>> pairs;
+    for (size_t i = 0; i + 1 < bounds.size(); i += 2)
+    {
+        SourceIterator left = source + bounds[i];
+        std::ptrdiff_t left_size = bounds[i + 1] - bounds[i];
+        std::ptrdiff_t right_size = (i + 2 < bounds.size()) ? bounds[i + 2] - bounds[i + 1] : 0;
+        pairs.push_back(trimChunkPair(left, left_size, left + left_size, right_size, comp));
+    }
+
+    for (size_t i = 0; i + 1 < bounds.size(); i += 2)
+    {
+        new_bounds.push_back(bounds[i]);
+        ChunkPair<SourceIterator> pair = pairs[i / 2];
+        DestIterator out = dest + bounds[i];
+        std::ptrdiff_t merged_size = pair.left_size + pair.right_size;
+        std::ptrdiff_t n_parts = std::max<std::ptrdiff_t>(1, n_threads * merged_size / arr_size);
+
+        for (std::ptrdiff_t part = 0; part < n_parts; part++)
+        {
+            std::ptrdiff_t out_start = merged_size * part / n_parts;
+            std::ptrdiff_t out_finish = merged_size * (part + 1) / n_parts;
+            ranges.push_back(std::make_pair(bounds[i] + out_start, bounds[i] + out_finish));
+
+            futures.push_back(pool.submit([=]() mutable {
+                DestIterator part_dest = out + out_start;
+                try
+                {
+                    mergeChunkPairPart<Construct>(pair, out_start, out_finish, part_dest, comp);
+                }
+                catch (...)
+                {
+                    destroyConstructed<Construct>(out + out_start, part_dest);
+                    throw;
+                }
+            }));
+        }
+    }
+
+    new_bounds.push_back(arr_size);
+    waitRound(futures, ranges, dest, std::integral_constant<bool, Construct>());
+    bounds.swap(new_bounds);
+}
+
+//Uninitialized memory for a copy of the array, its elements are destroyed if they were constructed
+template <class Type>
+class ParallelMergeBuffer
+{
+public:
+    explicit ParallelMergeBuffer(std::ptrdiff_t size):
+        data (allocator.allocate(size)),
+        size (size),
+        constructed (false)
+
+        {}
+
+    ~ParallelMergeBuffer()
+    {
+        for (std::ptrdiff_t i = 0; constructed && i < size; i++)
+            data[i].~Type();
+        allocator.deallocate(data, size);
+    }
+
+    ParallelMergeBuffer(const ParallelMergeBuffer&) = delete;
+    ParallelMergeBuffer& operator =(const ParallelMergeBuffer&) = delete;
+
+    Type* begin()
+    {
+        return data;
+    }
+
+    void setConstructed()
+    {
+        constructed = true;
+    }
+
+private:
+    std::allocator<Type> allocator;
+    Type* data;
+    std::ptrdiff_t size;
+    bool constructed;
+};
+
+template <class RandomAccessIterator, class Compare>
+bool areChunksInOrder(RandomAccessIterator start, const std::vector<std::ptrdiff_t>& bounds, Compare comp)
+{
+    for (size_t i = 1; i + 1 < bounds.size(); i++)
+    {
+        if (comp(start[bounds[i]], start[bounds[i] - 1]))
+            return false;
+    }
+    return true;
+}
+
+//Merges run in parallel only if the merge buffer budget of params holds a copy of the whole array,
+//with any smaller budget the sorted chunks are merged by kWayMergeInplace on the calling thread
+template <class RandomAccessIterator, class Compare>
+void parallelTimSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                     TimSortThreadPool& pool, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    std::ptrdiff_t arr_size = finish - start;
+    std::ptrdiff_t n_chunks = std::min<std::ptrdiff_t>(pool.getThreadsNumber(), arr_size / MIN_PARALLEL_LENGTH);
+
+    if (n_chunks < 2)
+    {
+        timSort(start, finish, comp, params);
+        return;
+    }
+
+    std::vector<std::ptrdiff_t> bounds;
+    for (std::ptrdiff_t i = 0; i <= n_chunks; i++)
+        bounds.push_back(arr_size * i / n_chunks);
+
+    std::vector<std::future<void>> futures;
+    for (std::ptrdiff_t i = 0; i < n_chunks; i++)
+    {
+        RandomAccessIterator chunk_start = start + bounds[i];
+        RandomAccessIterator chunk_finish = start + bounds[i + 1];
+        const ITimSortParams* chunk_params = &params;
+        futures.push_back(pool.submit([chunk_start, chunk_finish, comp, chunk_params]() mutable {
+            timSort(chunk_start, chunk_finish, comp, *chunk_params);
+        }));
+    }
+    waitAll(futures);
+
+    if (areChunksInOrder(start, bounds, comp))
+        return;
+    if (params.getMergeBufferBudget() / sizeof(ValueType) < static_cast<size_t>(arr_size))
+    {
+        kWayMergeInplace(start, bounds, comp, params);
+        return;
+    }
+
+    //Chunks are moved between the array and the buffer, one round of merges each way.
+    //The first round constructs all elements of the buffer
+    ParallelMergeBuffer<ValueType> buffer(arr_size);
+    mergeChunksRound<true>(start, buffer.begin(), bounds, comp, pool);
+    buffer.setConstructed();
+    bool in_buffer = true;
+    while (bounds.size() > 2)
+    {
+        if (in_buffer)
+            mergeChunksRound<false>(buffer.begin(), start, bounds, comp, pool);
+        else
+            mergeChunksRound<false>(start, buffer.begin(), bounds, comp, pool);
+        in_buffer = !in_buffer;
+    }
+
+    if (in_buffer)
+    {
+        int n_threads = pool.getThreadsNumber();
+        for (int i = 0; i < n_threads; i++)
+        {
+            std::ptrdiff_t part_start = arr_size * i / n_threads;
+            std::ptrdiff_t part_finish = arr_size * (i + 1) / n_threads;
+            ValueType* part = buffer.begin() + part_start;
+            futures.push_back(pool.submit([part, part_start, part_finish, start]() mutable {
+                std::move(part, part + (part_finish - part_start), start + part_start);
+            }));
+        }
+        waitAll(futures);
+    }
+}
+
+template <class RandomAccessIterator>
+void parallelTimSort(RandomAccessIterator start, RandomAccessIterator finish,
+                     TimSortThreadPool& pool, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    parallelTimSort(start, finish,
+                    std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>(), pool, params);
+}
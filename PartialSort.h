@@ -0,0 +1,72 @@
+/*
+PartialSort.h
+Stable partial sort which takes advantage of runs in the input
+1. Offers timPartialSort: the smallest middle - start elements are placed in [start, middle)
+   in the order stable sorting would give them, the rest are left in [middle, finish) in no order
+2. The first k elements are sorted by timSort and become the k best. Later elements less than
+   the k-th best are gathered right after them; every k gathered ones are sorted by timSort
+   and merged into the k best, of which only the first k are kept
+3. Elements not less than the k-th best cost one comparison, so sorted and nearly sorted
+   inputs take one pass besides sorting the first k
+4. With NO_MERGE_BUFFER every merge goes through symMerge, which keeps the result stable
+   at O(log k) times more moves than the unstable inplaceMerge of timSort
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include "TimSort.h"
+
+template <class RandomAccessIterator, class Compare>
+void timPartialSort(RandomAccessIterator start, RandomAccessIterator middle, RandomAccessIterator finish,
+                    Compare comp, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    std::ptrdiff_t k = middle - start;
+    if (k <= 0)
+        return;
+
+    NoTimSortStats stats;
+    MergeState<RandomAccessIterator> merge_state(params.getMergeBufferBudget(), 2 * k, params.getGallop(), stats);
+    merge_state.makeInplaceStable();
+    RunStackMerger<RandomAccessIterator, Compare, ITimSortParams, NoTimSortStats> merger(comp, params, merge_state);
+    timSortReusing(start, middle, comp, params, merge_state, merger, stats);
+
+    RandomAccessIterator curr = middle;
+    RandomAccessIterator last_best = middle - 1;
+    while (true)
+    {
+        RandomAccessIterator pending_finish = middle;
+        while (pending_finish - middle < k)
+        {
+            //Later elements equal to the k-th never get in, which keeps the result stable
+            while (curr != finish && !comp(*curr, *last_best))
+                curr++;
+            if (curr == finish)
+                break;
+
+            if (curr != pending_finish)
+                timSortSwap(*pending_finish, *curr);
+            pending_finish++;
+            curr++;
+        }
+        if (pending_finish == middle)
+            break;
+
+        //Gathered elements come after all the best ones, so on equality the best ones stay first
+        timSortReusing(middle, pending_finish, comp, params, merge_state, merger, stats);
+        Run<RandomAccessIterator> best = {start, k};
+        Run<RandomAccessIterator> pending = {middle, pending_finish - middle};
+        merge_state.restart(2 * k);
+        mergeRuns(best, pending, comp, merge_state);
+    }
+}
+
+template <class RandomAccessIterator>
+void timPartialSort(RandomAccessIterator start, RandomAccessIterator middle, RandomAccessIterator finish,
+                    const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    timPartialSort(start, middle, finish,
+                   std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>(), params);
+}
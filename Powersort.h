@@ -0,0 +1,102 @@
+/*
+Powersort.h
+Merge order of Powersort (Munro and Wild), selected by MS_POWERSORT
+1. Offers nodePower: depth of the boundary between two neighbouring runs in the
+   binary tree that halves the whole array
+2. Offers class PowersortMerger which merges runs in the order of decreasing node powers
+   while they are being found
+The order is within a small constant of the optimal merge cost, and the run stack
+never holds more than one run per power, so it is a fixed-size array
+*/
+
+#pragma once
+#include <cstddef>
+#include "Run.h"
+#include "BufferedMerge.h"
+
+//Powers are at most the number of bits in the array length, plus the bottom run
+const int MAX_POWERSORT_STACK = sizeof(std::ptrdiff_t) * 8 + 1;
+
+//Runs [left_start, left_start + left_size) and the next right_size elements of an array of arr_size
+//The power is the first bit where binary fractions of their midpoints divided by arr_size differ
+inline int nodePower(std::ptrdiff_t left_start, std::ptrdiff_t left_size, std::ptrdiff_t right_size,
+                     std::ptrdiff_t arr_size)
+{
+    //Doubled midpoints, so they stay integral
+    std::ptrdiff_t left_mid = 2 * left_start + left_size;
+    std::ptrdiff_t right_mid = left_mid + left_size + right_size;
+    int power = 0;
+
+    while (true)
+    {
+        power++;
+        if (left_mid >= arr_size)
+        {
+            left_mid -= arr_size;
+            right_mid -= arr_size;
+        }
+        else if (right_mid >= arr_size)
+            return power;
+
+        left_mid <<= 1;
+        right_mid <<= 1;
+    }
+}
+
+//Runs are pushed left to right as they are found, mergeAll finishes the sort
+template <class RandomAccessIterator, class Compare, class Stats>
+class PowersortMerger
+{
+public:
+    PowersortMerger(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                    MergeState<RandomAccessIterator, Stats>& state):
+        start (start),
+        arr_size (finish - start),
+        comp (comp),
+        state (state),
+        stack_size (0)
+
+        {}
+
+    void pushRun(Run<RandomAccessIterator> run)
+    {
+        if (stack_size > 0)
+        {
+            Run<RandomAccessIterator>& top = run_stack[stack_size - 1];
+            int power = nodePower(top.start - start, top.size, run.size, arr_size);
+
+            while (stack_size > 1 && powers[stack_size - 2] > power)
+                mergeTop();
+
+            powers[stack_size - 1] = power;
+        }
+
+        run_stack[stack_size++] = run;
+        state.getStats().updateStackDepth(stack_size);
+    }
+
+    void mergeAll()
+    {
+        while (stack_size > 1)
+            mergeTop();
+    }
+
+private:
+    void mergeTop()
+    {
+        Run<RandomAccessIterator>& left = run_stack[stack_size - 2];
+        mergeRuns(left, run_stack[stack_size - 1], comp, state);
+        left.size += run_stack[stack_size - 1].size;
+        stack_size--;
+    }
+
+    RandomAccessIterator start;
+    std::ptrdiff_t arr_size;
+    Compare comp;
+    MergeState<RandomAccessIterator, Stats>& state;
+
+    //powers[i] belongs to the boundary between run_stack[i] and run_stack[i + 1]
+    Run<RandomAccessIterator> run_stack[MAX_POWERSORT_STACK];
+    int powers[MAX_POWERSORT_STACK];
+    int stack_size;
+};
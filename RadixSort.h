@@ -0,0 +1,211 @@
+/*
+RadixSort.h
+Stable LSD radix sort for arithmetic keys and a hybrid of it with timSort
+1. Offers radixSort for integers, float and double ordered by std::less or std::greater:
+   one counting pass builds the histograms of all bytes, then one scatter pass
+   per byte is made, skipping bytes which are equal in all elements
+2. Offers hybridTimSort: natural runs are counted as timSort would find them, inputs where
+   runs are short on average go to radixSort, structured inputs and other types go to timSort
+Both give the same order as timSort, equal elements keep their order. NaN is not supported,
+-0.0 and 0.0 are equal as for std::less
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+#include "TimSort.h"
+
+const int RADIX_BITS = 8;
+const int RADIX_BUCKETS = 1 << RADIX_BITS;
+//Smaller inputs are cheaper to sort by timSort than to count
+const std::ptrdiff_t RADIX_MIN_SIZE = 1024;
+//Inputs whose natural runs are shorter than this on average go to radixSort
+const std::ptrdiff_t RADIX_MAX_AVERAGE_RUN = 16;
+
+template <class Type, class Compare>
+struct IsRadixSortable
+{
+    static const bool value = (std::is_integral<Type>::value || std::is_same<Type, float>::value ||
+                               std::is_same<Type, double>::value) &&
+                              !std::is_same<Type, bool>::value &&
+                              (std::is_same<Compare, std::less<Type>>::value ||
+                               std::is_same<Compare, std::greater<Type>>::value);
+};
+
+template <int Size>
+struct RadixUnsigned;
+
+template <> struct RadixUnsigned<1> { typedef std::uint8_t Type; };
+template <> struct RadixUnsigned<2> { typedef std::uint16_t Type; };
+template <> struct RadixUnsigned<4> { typedef std::uint32_t Type; };
+template <> struct RadixUnsigned<8> { typedef std::uint64_t Type; };
+
+//Unsigned key ordered as the values are ordered by std::less
+template <class Type>
+typename RadixUnsigned<sizeof(Type)>::Type getRadixKey(Type value)
+{
+    typedef typename RadixUnsigned<sizeof(Type)>::Type Key;
+    const Key SIGN_BIT = Key(1) << (sizeof(Type) * 8 - 1);
+
+    Key key;
+    memcpy(&key, &value, sizeof(Type));
+    if (std::is_floating_point<Type>::value)
+    {
+        if (key == SIGN_BIT)
+            key = 0;
+        //Negative numbers are ordered backwards by their bits
+        return (key & SIGN_BIT) ? Key(~key) : Key(key | SIGN_BIT);
+    }
+    if (std::is_signed<Type>::value)
+        return key ^ SIGN_BIT;
+    return key;
+}
+
+template <class Source, class Dest, class Type>
+void radixScatter(Source start, Source finish, Dest dest, std::ptrdiff_t* offsets, int shift, bool descending)
+{
+    for (Source curr = start; curr != finish; ++curr)
+    {
+        typename RadixUnsigned<sizeof(Type)>::Type key = getRadixKey<Type>(*curr);
+        if (descending)
+            key = ~key;
+        dest[offsets[(key >> shift) & (RADIX_BUCKETS - 1)]++] = *curr;
+    }
+}
+
+//buffer is resized to the length of the range, it may be kept between calls
+template <class RandomAccessIterator, class Compare>
+void radixSort(RandomAccessIterator start, RandomAccessIterator finish, Compare,
+               std::vector<typename std::iterator_traits<RandomAccessIterator>::value_type>& buffer)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type Type;
+    typedef typename RadixUnsigned<sizeof(Type)>::Type Key;
+    static_assert(IsRadixSortable<Type, Compare>::value, "radixSort needs an arithmetic type and std::less or std::greater");
+    const int N_DIGITS = sizeof(Type) * 8 / RADIX_BITS;
+    const bool DESCENDING = std::is_same<Compare, std::greater<Type>>::value;
+
+    std::ptrdiff_t arr_size = finish - start;
+    if (arr_size < 2)
+        return;
+
+    std::vector<std::ptrdiff_t> counts(N_DIGITS * RADIX_BUCKETS, 0);
+    for (RandomAccessIterator curr = start; curr != finish; ++curr)
+    {
+        Key key = getRadixKey<Type>(*curr);
+        if (DESCENDING)
+            key = ~key;
+        for (int digit = 0; digit < N_DIGITS; digit++)
+            counts[digit * RADIX_BUCKETS + ((key >> (digit * RADIX_BITS)) & (RADIX_BUCKETS - 1))]++;
+    }
+
+    buffer.resize(arr_size);
+    bool in_buffer = false;
+    for (int digit = 0; digit < N_DIGITS; digit++)
+    {
+        std::ptrdiff_t* offsets = &counts[digit * RADIX_BUCKETS];
+        if (std::find(offsets, offsets + RADIX_BUCKETS, arr_size) != offsets + RADIX_BUCKETS)
+            continue;
+
+        std::ptrdiff_t bucket_start = 0;
+        for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+        {
+            std::ptrdiff_t bucket_size = offsets[bucket];
+            offsets[bucket] = bucket_start;
+            bucket_start += bucket_size;
+        }
+
+        if (in_buffer)
+            radixScatter<typename std::vector<Type>::iterator, RandomAccessIterator, Type>(
+                buffer.begin(), buffer.end(), start, offsets, digit * RADIX_BITS, DESCENDING);
+        else
+            radixScatter<RandomAccessIterator, typename std::vector<Type>::iterator, Type>(
+                start, finish, buffer.begin(), offsets, digit * RADIX_BITS, DESCENDING);
+        in_buffer = !in_buffer;
+    }
+
+    if (in_buffer)
+        std::copy(buffer.begin(), buffer.end(), start);
+}
+
+template <class RandomAccessIterator, class Compare>
+void radixSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    std::vector<typename std::iterator_traits<RandomAccessIterator>::value_type> buffer;
+    radixSort(start, finish, comp, buffer);
+}
+
+//True if there are more than max_runs natural runs, counted as nextRun finds them
+template <class RandomAccessIterator, class Compare>
+bool hasMoreRunsThan(RandomAccessIterator start, RandomAccessIterator finish, Compare comp, std::ptrdiff_t max_runs)
+{
+    std::ptrdiff_t n_runs = 0;
+    RandomAccessIterator run_start = start;
+    while (run_start != finish)
+    {
+        if (++n_runs > max_runs)
+            return true;
+
+        RandomAccessIterator run_finish = run_start + 1;
+        if (run_finish != finish)
+        {
+            if (!comp(*run_finish, *run_start))
+                run_finish = findAscendingRunEnd(run_start, finish, comp);
+            else
+                run_finish = findDescendingRunEnd(run_start, finish, comp);
+        }
+        run_start = run_finish;
+    }
+    return false;
+}
+
+template <class RandomAccessIterator, class Compare>
+void hybridSortImpl(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                    std::vector<typename std::iterator_traits<RandomAccessIterator>::value_type>& buffer,
+                    const ITimSortParams& params, std::true_type)
+{
+    std::ptrdiff_t arr_size = finish - start;
+    if (arr_size >= RADIX_MIN_SIZE && hasMoreRunsThan(start, finish, comp, arr_size / RADIX_MAX_AVERAGE_RUN))
+        radixSort(start, finish, comp, buffer);
+    else
+        timSort(start, finish, comp, params);
+}
+
+template <class RandomAccessIterator, class Compare>
+void hybridSortImpl(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                    std::vector<typename std::iterator_traits<RandomAccessIterator>::value_type>&,
+                    const ITimSortParams& params, std::false_type)
+{
+    timSort(start, finish, comp, params);
+}
+
+//buffer is used by radixSort only, it may be kept between calls
+template <class RandomAccessIterator, class Compare>
+void hybridTimSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                   std::vector<typename std::iterator_traits<RandomAccessIterator>::value_type>& buffer,
+                   const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    hybridSortImpl(start, finish, comp, buffer, params,
+                   std::integral_constant<bool, IsRadixSortable<ValueType, Compare>::value>());
+}
+
+template <class RandomAccessIterator, class Compare>
+void hybridTimSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                   const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    std::vector<typename std::iterator_traits<RandomAccessIterator>::value_type> buffer;
+    hybridTimSort(start, finish, comp, buffer, params);
+}
+
+template <class RandomAccessIterator>
+void hybridTimSort(RandomAccessIterator start, RandomAccessIterator finish,
+                   const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    hybridTimSort(start, finish, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>(), params);
+}
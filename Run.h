@@ -2,18 +2,24 @@
 Run.h
 Consists of operations working with blocks of data in array called Runs
 1. Offers template class Run
-2. Allows dividing your array into runs using ITimSortParams
-3. Allows merging two runs with usual merge
-4. Offers timSortSwap function
+2. Allows dividing your array into runs using ITimSortParams or a static merge policy
+3. Allows merging two runs with usual merge, from the left or from the right end,
+   with adaptive galloping and trimming of elements already in place
+4. Offers timSortSwap function, a customization point for element swapping
 5. Offers merge methods with different types: swapping elements or just erasing those in buffer
 */
 
 #pragma once
+#include <cstddef>
 #include <vector>
 #include <iterator>
 #include <stack>
 #include <functional>
+#include <utility>
 #include "TimSortParams.h"
+#include "SmallSort.h"
+#include "SimdScan.h"
+#include "TimSortStats.h"
 
 enum EWriteMethods
 {
@@ -21,64 +27,87 @@ enum EWriteMethods
     WM_ERASING_WRITE
 };
 
+//Swap found by argument-dependent lookup is preferred, so types may customize it
 template <class Type>
 void timSortSwap(Type& a, Type& b)
 {
-    Type c(a);
-    a = b;
-    b = c;
+    using std::swap;
+    swap(a, b);
 }
 
 template <class RandomAccessIterator>
 struct Run
 {
     RandomAccessIterator start;
-    int size;
+    std::ptrdiff_t size;
 };
 
-template <class RandomAccessIterator, class Compare>
-void divideArrayToRuns(RandomAccessIterator start, RandomAccessIterator finish, 
-                       std::vector<Run<RandomAccessIterator>>& runs,
-                       Compare comp, const ITimSortParams& params = DEFAULT_PARAMS)
+template <class RandomAccessIterator>
+void reverseArrayPart(RandomAccessIterator start, RandomAccessIterator finish)
 {
-    RandomAccessIterator curr_start = start;
-    RandomAccessIterator curr_finish = start + 1;
-    int min_run = params.minRun(finish - start);
+    finish--;
 
-    while (curr_start != finish)
+    while (start < finish)
     {
-        if (curr_finish == finish)
-        {
-            Run<RandomAccessIterator> new_run = {curr_start, finish - curr_start};
-            runs.push_back(new_run);
-            break;
-        }
+        timSortSwap(*start, *finish);
+        start++;
+        finish--;
+    }
+}
 
-        if (comp(*curr_start, *curr_finish))
-        {
-            while (curr_finish != finish && comp(*(curr_finish - 1), *curr_finish))
-                curr_finish++;
-        }
+//Natural run starting at run_start (reversed if strictly descending), extended to min_run elements.
+//Equal neighbours continue an ascending run, so blocks of equal keys are taken as one run
+template <class RandomAccessIterator, class Compare, class Stats>
+Run<RandomAccessIterator> nextRun(RandomAccessIterator run_start, RandomAccessIterator finish,
+                                  Compare comp, std::ptrdiff_t min_run, Stats& stats)
+{
+    stats.startPhase(TP_RUN_DETECTION);
+    RandomAccessIterator run_finish = run_start + 1;
+    if (run_finish != finish)
+    {
+        if (!comp(*run_finish, *run_start))
+            run_finish = findAscendingRunEnd(run_start, finish, comp);
         else
         {
-            while (curr_finish != finish && comp(*curr_finish, *(curr_finish - 1)))
-                curr_finish++;
-            reverseArrayPart(curr_start, curr_finish);
+            run_finish = findDescendingRunEnd(run_start, finish, comp);
+            reverseArrayPart(run_start, run_finish);
         }
+    }
 
-        while (curr_finish != finish && curr_finish - curr_start < min_run)
-            curr_finish++;
-
-        Run<RandomAccessIterator> new_run = {curr_start, curr_finish - curr_start};
-        insertionSort(curr_start, curr_finish, comp);
-        runs.push_back(new_run);
-        curr_start = curr_finish;
+    stats.finishPhase(TP_RUN_DETECTION);
+    stats.countRun();
 
-        if (curr_finish != finish)
-            curr_finish++;
-        else
-            break;
+    RandomAccessIterator natural_finish = run_finish;
+    if (run_finish - run_start < min_run)
+        run_finish = (finish - run_start < min_run) ? finish : run_start + min_run;
+    if (run_finish != natural_finish)
+    {
+        stats.startPhase(TP_SMALL_SORT);
+        smallSort(run_start, natural_finish, run_finish, comp);
+        stats.finishPhase(TP_SMALL_SORT);
     }
+
+    Run<RandomAccessIterator> run = {run_start, run_finish - run_start};
+    return run;
+}
+
+template <class RandomAccessIterator, class Compare>
+Run<RandomAccessIterator> nextRun(RandomAccessIterator run_start, RandomAccessIterator finish,
+                                  Compare comp, std::ptrdiff_t min_run)
+{
+    NoTimSortStats stats;
+    return nextRun(run_start, finish, comp, min_run, stats);
+}
+
+template <class RandomAccessIterator, class Compare, class Params = ITimSortParams>
+void divideArrayToRuns(RandomAccessIterator start, RandomAccessIterator finish, 
+                       std::vector<Run<RandomAccessIterator>>& runs,
+                       Compare comp, const Params& params = DEFAULT_PARAMS)
+{
+    std::ptrdiff_t min_run = params.minRun(finish - start);
+
+    for (RandomAccessIterator curr_start = start; curr_start != finish; curr_start += runs.back().size)
+        runs.push_back(nextRun(curr_start, finish, comp, min_run));
 }
 
 template <class RandomAccessIterator>
@@ -93,133 +122,319 @@ template <class Type>
 void writeToDestination(Type& dest, Type& src, EWriteMethods write_type)
 {
     if (write_type == WM_SWAP_WRITE)
+        timSortSwap(dest, src);
+    else
+        dest = std::move(src);
+}
+
+//Position of key in sorted [start, start + len) before all elements equal to it, search starts at hint
+template <class RandomAccessIterator, class KeyIterator, class Compare>
+std::ptrdiff_t gallopLeft(KeyIterator key, RandomAccessIterator start, std::ptrdiff_t len, std::ptrdiff_t hint, Compare comp)
+{
+    std::ptrdiff_t last_offset = 0;
+    std::ptrdiff_t offset = 1;
+
+    if (comp(start[hint], *key))
     {
-        Type temp = src;
-        src = dest;
-        dest = temp;
+        //Gallop right until start[hint + last_offset] < key <= start[hint + offset]
+        std::ptrdiff_t max_offset = len - hint;
+        while (offset < max_offset && comp(start[hint + offset], *key))
+        {
+            last_offset = offset;
+            offset = 2 * offset + 1;
+            if (offset <= 0)
+                offset = max_offset;
+        }
+        if (offset > max_offset)
+            offset = max_offset;
+
+        last_offset += hint;
+        offset += hint;
     }
     else
-        dest = src;
+    {
+        //Gallop left until start[hint - offset] < key <= start[hint - last_offset]
+        std::ptrdiff_t max_offset = hint + 1;
+        while (offset < max_offset && !comp(start[hint - offset], *key))
+        {
+            last_offset = offset;
+            offset = 2 * offset + 1;
+            if (offset <= 0)
+                offset = max_offset;
+        }
+        if (offset > max_offset)
+            offset = max_offset;
+
+        std::ptrdiff_t temp = last_offset;
+        last_offset = hint - offset;
+        offset = hint - temp;
+    }
+
+    last_offset++;
+    while (last_offset < offset)
+    {
+        std::ptrdiff_t med = last_offset + (offset - last_offset) / 2;
+        if (comp(start[med], *key))
+            last_offset = med + 1;
+        else
+            offset = med;
+    }
+
+    return offset;
 }
 
-template <class RandomAccessIterator, class Compare>
-int getFollowingLessEqual(RandomAccessIterator& start, int len, RandomAccessIterator& min_value, Compare comp)
+//Position of key in sorted [start, start + len) after all elements equal to it, search starts at hint
+template <class RandomAccessIterator, class KeyIterator, class Compare>
+std::ptrdiff_t gallopRight(KeyIterator key, RandomAccessIterator start, std::ptrdiff_t len, std::ptrdiff_t hint, Compare comp)
 {
-    if (comp(*min_value, *start))
+    std::ptrdiff_t last_offset = 0;
+    std::ptrdiff_t offset = 1;
+
+    if (comp(*key, start[hint]))
     {
-        return 0;
+        //Gallop left until start[hint - offset] <= key < start[hint - last_offset]
+        std::ptrdiff_t max_offset = hint + 1;
+        while (offset < max_offset && comp(*key, start[hint - offset]))
+        {
+            last_offset = offset;
+            offset = 2 * offset + 1;
+            if (offset <= 0)
+                offset = max_offset;
+        }
+        if (offset > max_offset)
+            offset = max_offset;
+
+        std::ptrdiff_t temp = last_offset;
+        last_offset = hint - offset;
+        offset = hint - temp;
     }
-    //Then left is <=
-    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
-    int left = 0, right = 1;
-    while (right < len && !comp(*min_value, *(start + right)))
+    else
     {
-        left = right;
-        right *= 2;
+        //Gallop right until start[hint + last_offset] <= key < start[hint + offset]
+        std::ptrdiff_t max_offset = len - hint;
+        while (offset < max_offset && !comp(*key, start[hint + offset]))
+        {
+            last_offset = offset;
+            offset = 2 * offset + 1;
+            if (offset <= 0)
+                offset = max_offset;
+        }
+        if (offset > max_offset)
+            offset = max_offset;
+
+        last_offset += hint;
+        offset += hint;
     }
-    if (right > len)
-        right = len;
 
-    int med = (left + right) / 2;
-    while (right - left > 1)
+    last_offset++;
+    while (last_offset < offset)
     {
-        if (comp(*(start + med), *min_value))
-            left = med;
+        std::ptrdiff_t med = last_offset + (offset - last_offset) / 2;
+        if (comp(*key, start[med]))
+            offset = med;
         else
-            right = med;
-        med = (left + right) / 2;
+            last_offset = med + 1;
     }
-   
-    return right;
+
+    return offset;
 }
 
+//Drops the prefix of left and the suffix of right which are already in place.
+//Returns false when nothing is left to merge
 template <class RandomAccessIterator, class Compare>
-void mergeRunsWithBuffer(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
-                         RandomAccessIterator buffer, Compare comp, EWriteMethods write_type = WM_ERASING_WRITE,
-                         int gallop = NO_GALLOPING_MODE)
+bool trimRunsForMerge(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right, Compare comp)
 {
-    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
-    for (int i = 0; i < right.start - left.start; i++)
-        writeToDestination(buffer[i], left.start[i], write_type);
+    if (left.size == 0 || right.size == 0)
+        return false;
+
+    std::ptrdiff_t in_place = gallopRight(right.start, left.start, left.size, 0, comp);
+    left.start += in_place;
+    left.size -= in_place;
+    if (left.size == 0)
+        return false;
+
+    right.size = gallopLeft(left.start + left.size - 1, right.start, right.size, right.size - 1, comp);
+    return right.size != 0;
+}
 
+//min_gallop is the adaptive threshold for galloping: it goes down while galloping pays off
+//and up when it doesn't, so it may be kept between merges of one sort.
+//buffer already holds the elements of left, which are written back to the array
+template <class RandomAccessIterator, class BufferIterator, class Compare, class Stats>
+void mergeBufferedLeft(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
+                       BufferIterator buffer, Compare comp, EWriteMethods write_type,
+                       int gallop, int& min_gallop, Stats& stats)
+{
     RandomAccessIterator dest = left.start;
-    RandomAccessIterator left_ptr = buffer;
+    BufferIterator left_ptr = buffer;
+    BufferIterator left_finish = buffer + left.size;
     RandomAccessIterator right_ptr = right.start;
+    RandomAccessIterator right_finish = right.start + right.size;
 
-    int left_in_row = 0;
-    int right_in_row = 0;
-
-    while (left_ptr - buffer < left.size && right_ptr - right.start < right.size)
+    while (left_ptr != left_finish && right_ptr != right_finish)
     {
-        if (comp(*left_ptr, *right_ptr))
+        int left_in_row = 0;
+        int right_in_row = 0;
+
+        while (left_ptr != left_finish && right_ptr != right_finish &&
+               (gallop == NO_GALLOPING_MODE || (left_in_row < min_gallop && right_in_row < min_gallop)))
         {
-            writeToDestination(*(dest++), *(left_ptr++), write_type);
-            left_in_row++;
-            right_in_row = 0;
+            if (comp(*right_ptr, *left_ptr))
+            {
+                writeToDestination(*(dest++), *(right_ptr++), write_type);
+                right_in_row++;
+                left_in_row = 0;
+            }
+            else
+            {
+                writeToDestination(*(dest++), *(left_ptr++), write_type);
+                left_in_row++;
+                right_in_row = 0;
+            }
         }
-        else
+
+        if (left_ptr == left_finish || right_ptr == right_finish)
+            break;
+
+        std::ptrdiff_t n_left = 0, n_right = 0;
+        stats.countGallopEntry();
+        do
         {
-            writeToDestination(*(dest++), *(right_ptr++), write_type);
-            right_in_row++;
-            left_in_row = 0;
+            if (min_gallop > 1)
+                min_gallop--;
+
+            n_left = gallopRight(right_ptr, left_ptr, left_finish - left_ptr, 0, comp);
+            for (std::ptrdiff_t i = 0; i < n_left; i++)
+                writeToDestination(*(dest++), *(left_ptr++), write_type);
+            if (n_left >= gallop)
+                stats.countGallopSuccess();
+            if (left_ptr == left_finish)
+                break;
+
+            n_right = gallopLeft(left_ptr, right_ptr, right_finish - right_ptr, 0, comp);
+            for (std::ptrdiff_t i = 0; i < n_right; i++)
+                writeToDestination(*(dest++), *(right_ptr++), write_type);
+            if (n_right >= gallop)
+                stats.countGallopSuccess();
         }
-         
-        if ((right_in_row >= gallop || left_in_row >= gallop) && gallop != NO_GALLOPING_MODE &&
-            left_ptr - buffer < left.size && right_ptr - right.start < right.size)
-        {
-            RandomAccessIterator* start_gallop = &left_ptr;
-            int n_elems_galloping = 0;
+        while (right_ptr != right_finish && (n_left >= gallop || n_right >= gallop));
+
+        min_gallop++;
+    }
+
+    //Remaining elements of the right run are already in place
+    while (left_ptr != left_finish)
+        writeToDestination(*(dest++), *(left_ptr++), write_type);
+    stats.countMoves(dest - left.start);
+}
+
+template <class RandomAccessIterator, class BufferIterator, class Compare, class Stats>
+void mergeRunsWithBuffer(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
+                         BufferIterator buffer, Compare comp, EWriteMethods write_type,
+                         int gallop, int& min_gallop, Stats& stats)
+{
+    for (std::ptrdiff_t i = 0; i < right.start - left.start; i++)
+        writeToDestination(buffer[i], left.start[i], write_type);
+    stats.countMoves(left.size);
+    mergeBufferedLeft(left, right, buffer, comp, write_type, gallop, min_gallop, stats);
+}
+
+template <class RandomAccessIterator, class BufferIterator, class Compare>
+void mergeRunsWithBuffer(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
+                         BufferIterator buffer, Compare comp, EWriteMethods write_type = WM_ERASING_WRITE,
+                         int gallop = NO_GALLOPING_MODE)
+{
+    int min_gallop = gallop;
+    NoTimSortStats stats;
+    mergeRunsWithBuffer(left, right, buffer, comp, write_type, gallop, min_gallop, stats);
+}
+
+//buffer already holds the elements of right, the merge goes from the right end
+template <class RandomAccessIterator, class BufferIterator, class Compare, class Stats>
+void mergeBufferedRight(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
+                        BufferIterator buffer, Compare comp, EWriteMethods write_type,
+                        int gallop, int& min_gallop, Stats& stats)
+{
+    RandomAccessIterator dest = right.start + right.size;
+    RandomAccessIterator left_ptr = left.start + left.size;
+    BufferIterator right_ptr = buffer + right.size;
 
-            if (right_in_row >= gallop)
+    while (left_ptr != left.start && right_ptr != buffer)
+    {
+        int left_in_row = 0;
+        int right_in_row = 0;
+
+        while (left_ptr != left.start && right_ptr != buffer &&
+               (gallop == NO_GALLOPING_MODE || (left_in_row < min_gallop && right_in_row < min_gallop)))
+        {
+            if (comp(*(right_ptr - 1), *(left_ptr - 1)))
             {
-                start_gallop = &right_ptr;
-                n_elems_galloping = getFollowingLessEqual(right_ptr, right.size - (right_ptr - right.start),
-                                                          left_ptr, comp);
+                writeToDestination(*(--dest), *(--left_ptr), write_type);
+                left_in_row++;
                 right_in_row = 0;
             }
             else
             {
-                start_gallop = &left_ptr;
-                n_elems_galloping = getFollowingLessEqual(left_ptr, left.size - (left_ptr - buffer),
-                                                          right_ptr, comp);
+                writeToDestination(*(--dest), *(--right_ptr), write_type);
+                right_in_row++;
                 left_in_row = 0;
             }
+        }
 
-            for (int i = 0; i < n_elems_galloping; i++)
-            {
-                writeToDestination(*(dest++), *((*start_gallop)++), write_type);
-            }
+        if (left_ptr == left.start || right_ptr == buffer)
+            break;
+
+        std::ptrdiff_t n_left = 0, n_right = 0;
+        stats.countGallopEntry();
+        do
+        {
+            if (min_gallop > 1)
+                min_gallop--;
+
+            std::ptrdiff_t left_len = left_ptr - left.start;
+            n_left = left_len - gallopRight(right_ptr - 1, left.start, left_len, left_len - 1, comp);
+            for (std::ptrdiff_t i = 0; i < n_left; i++)
+                writeToDestination(*(--dest), *(--left_ptr), write_type);
+            if (n_left >= gallop)
+                stats.countGallopSuccess();
+            if (left_ptr == left.start)
+                break;
+
+            std::ptrdiff_t right_len = right_ptr - buffer;
+            n_right = right_len - gallopLeft(left_ptr - 1, buffer, right_len, right_len - 1, comp);
+            for (std::ptrdiff_t i = 0; i < n_right; i++)
+                writeToDestination(*(--dest), *(--right_ptr), write_type);
+            if (n_right >= gallop)
+                stats.countGallopSuccess();
         }
-    }
+        while (right_ptr != buffer && (n_left >= gallop || n_right >= gallop));
 
-    if (left_ptr - buffer == left.size)
-    {
-        while (right_ptr - right.start < right.size)
-            writeToDestination(*(dest++), *(right_ptr++), write_type);
-    }
-    else
-    {
-        while (left_ptr - buffer < left.size)
-            writeToDestination(*(dest++), *(left_ptr++), write_type);
+        min_gallop++;
     }
+
+    //Remaining elements of the left run are already in place
+    while (right_ptr != buffer)
+        writeToDestination(*(--dest), *(--right_ptr), write_type);
+    stats.countMoves(right.start + right.size - dest);
 }
 
-/*template <class RandomAccessIterator, class Compare>
-void mergeRuns(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, Compare comp, EWriteMethods write_type = WM_ERASING_WRITE, int gallop = NO_GALLOPING_MODE)
+template <class RandomAccessIterator, class BufferIterator, class Compare, class Stats>
+void mergeRunsWithBufferFromRight(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
+                                  BufferIterator buffer, Compare comp, EWriteMethods write_type,
+                                  int gallop, int& min_gallop, Stats& stats)
 {
-    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
-    ValueType* buf = new ValueType[right.start - left.start];
-    for (int i = 0; i < right.start - left.start; i++)
-        buf[i] = left.start[i];
-
-    mergeRunsWithBuffer(left, right, buf, comp, write_type, gallop);
-
-    delete[] buf;
+    for (std::ptrdiff_t i = 0; i < right.size; i++)
+        writeToDestination(buffer[i], right.start[i], write_type);
+    stats.countMoves(right.size);
+    mergeBufferedRight(left, right, buffer, comp, write_type, gallop, min_gallop, stats);
 }
 
-template <class RandomAccessIterator>
-void mergeRuns(Run<RandomAccessIterator> left, Run<RandomAccessIterator> right, EWriteMethods write_type = WM_ERASING_WRITE, int gallop = NO_GALLOPING_MODE)
+template <class RandomAccessIterator, class BufferIterator, class Compare>
+void mergeRunsWithBufferFromRight(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right,
+                                  BufferIterator buffer, Compare comp, EWriteMethods write_type = WM_ERASING_WRITE,
+                                  int gallop = NO_GALLOPING_MODE)
 {
-    mergeRuns(left, right, std::less_equal<typename std::iterator_traits<RandomAccessIterator>::value_type>(),
-              write_type, gallop);
-}*/   
\ No newline at end of file
+    int min_gallop = gallop;
+    NoTimSortStats stats;
+    mergeRunsWithBufferFromRight(left, right, buffer, comp, write_type, gallop, min_gallop, stats);
+}
@@ -0,0 +1,559 @@
+/*
+SimdMerge.h
+Merge kernels for arithmetic types compared with std::less or std::greater
+1. Offers branchless scalar merges from the left (low) and from the right (high) end
+2. Offers bitonic merge networks on AVX2 (32 and 64-bit integers) and SSE4.1 (32-bit integers)
+3. Offers fastMergeLow and fastMergeHigh choosing the kernel by the element type
+   and by CPU features detected at runtime
+Vector kernels are used only for integers: they are not stable, and equal integers can't be told apart
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TIMSORT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+template <class Type, class Compare>
+struct IsBranchlessMergeable
+{
+    static const bool value = std::is_arithmetic<Type>::value && !std::is_same<Type, bool>::value &&
+                              (std::is_same<Compare, std::less<Type>>::value ||
+                               std::is_same<Compare, std::greater<Type>>::value);
+};
+
+//Kernels work on raw memory, so only pointers and vector iterators are accepted
+template <class Iterator>
+struct IsContiguousIterator
+{
+    typedef typename std::iterator_traits<Iterator>::value_type ValueType;
+    static const bool value = std::is_pointer<Iterator>::value ||
+                              std::is_same<Iterator, typename std::vector<ValueType>::iterator>::value;
+};
+
+template <class Type, class Compare>
+void branchlessMergeLow(const Type* left, const Type* left_finish,
+                        Type* right, Type* right_finish, Type* dest, Compare comp)
+{
+    while (left != left_finish && right != right_finish)
+    {
+        bool take_right = comp(*right, *left);
+        *(dest++) = take_right ? *right : *left;
+        right += take_right;
+        left += !take_right;
+    }
+
+    //Remaining elements of the right run are already in place
+    std::copy(left, left_finish, dest);
+}
+
+template <class Type, class Compare>
+void branchlessMergeHigh(Type* left, Type* left_finish,
+                         const Type* right, const Type* right_finish, Type* dest_finish, Compare comp)
+{
+    while (left != left_finish && right != right_finish)
+    {
+        bool take_left = comp(*(right_finish - 1), *(left_finish - 1));
+        *(--dest_finish) = take_left ? *(left_finish - 1) : *(right_finish - 1);
+        left_finish -= take_left;
+        right_finish -= !take_left;
+    }
+
+    //Remaining elements of the left run are already in place
+    std::copy_backward(right, right_finish, dest_finish);
+}
+
+#ifdef TIMSORT_X86_SIMD
+
+inline bool cpuHasAvx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+inline bool cpuHasSse41()
+{
+    static const bool has_sse41 = __builtin_cpu_supports("sse4.1");
+    return has_sse41;
+}
+
+template <bool Descending>
+struct Avx2Int32Kernel
+{
+    typedef int32_t Type;
+    typedef __m256i Vector;
+    static const int WIDTH = 8;
+
+    __attribute__((target("avx2"))) static void minMax(Vector& low, Vector& high)
+    {
+        Vector a = low;
+        low = Descending ? _mm256_max_epi32(a, high) : _mm256_min_epi32(a, high);
+        high = Descending ? _mm256_min_epi32(a, high) : _mm256_max_epi32(a, high);
+    }
+
+    //Sorts a bitonic vector: compare-exchange at distances 4, 2 and 1
+    __attribute__((target("avx2"))) static Vector sortBitonic(Vector v)
+    {
+        Vector low = v, high = _mm256_permute2x128_si256(v, v, 1);
+        minMax(low, high);
+        v = _mm256_blend_epi32(low, high, 0xF0);
+
+        low = v;
+        high = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+        minMax(low, high);
+        v = _mm256_blend_epi32(low, high, 0xCC);
+
+        low = v;
+        high = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+        minMax(low, high);
+        return _mm256_blend_epi32(low, high, 0xAA);
+    }
+
+    //a and b are sorted, after the merge a holds the lower half and b the upper one
+    __attribute__((target("avx2"))) static void merge(Vector& a, Vector& b)
+    {
+        b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+        minMax(a, b);
+        a = sortBitonic(a);
+        b = sortBitonic(b);
+    }
+
+    __attribute__((target("avx2"))) static Vector load(const Type* src)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    }
+
+    __attribute__((target("avx2"))) static void store(Type* dest, Vector v)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), v);
+    }
+};
+
+template <bool Descending>
+struct Avx2Int64Kernel
+{
+    typedef int64_t Type;
+    typedef __m256i Vector;
+    static const int WIDTH = 4;
+
+    __attribute__((target("avx2"))) static void minMax(Vector& low, Vector& high)
+    {
+        Vector a = low;
+        Vector a_greater = _mm256_cmpgt_epi64(a, high);
+        Vector a_first = Descending ? a_greater : _mm256_andnot_si256(a_greater, _mm256_set1_epi64x(-1));
+        low = _mm256_blendv_epi8(high, a, a_first);
+        high = _mm256_blendv_epi8(a, high, a_first);
+    }
+
+    __attribute__((target("avx2"))) static Vector sortBitonic(Vector v)
+    {
+        Vector low = v, high = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+        minMax(low, high);
+        v = _mm256_blend_epi32(low, high, 0xF0);
+
+        low = v;
+        high = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 3, 0, 1));
+        minMax(low, high);
+        return _mm256_blend_epi32(low, high, 0xCC);
+    }
+
+    __attribute__((target("avx2"))) static void merge(Vector& a, Vector& b)
+    {
+        b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 1, 2, 3));
+        minMax(a, b);
+        a = sortBitonic(a);
+        b = sortBitonic(b);
+    }
+
+    __attribute__((target("avx2"))) static Vector load(const Type* src)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    }
+
+    __attribute__((target("avx2"))) static void store(Type* dest, Vector v)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), v);
+    }
+};
+
+template <bool Descending>
+struct Sse41Int32Kernel
+{
+    typedef int32_t Type;
+    typedef __m128i Vector;
+    static const int WIDTH = 4;
+
+    __attribute__((target("sse4.1"))) static void minMax(Vector& low, Vector& high)
+    {
+        Vector a = low;
+        low = Descending ? _mm_max_epi32(a, high) : _mm_min_epi32(a, high);
+        high = Descending ? _mm_min_epi32(a, high) : _mm_max_epi32(a, high);
+    }
+
+    __attribute__((target("sse4.1"))) static Vector sortBitonic(Vector v)
+    {
+        Vector low = v, high = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+        minMax(low, high);
+        v = _mm_blend_epi16(low, high, 0xF0);
+
+        low = v;
+        high = _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+        minMax(low, high);
+        return _mm_blend_epi16(low, high, 0xCC);
+    }
+
+    __attribute__((target("sse4.1"))) static void merge(Vector& a, Vector& b)
+    {
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));
+        minMax(a, b);
+        a = sortBitonic(a);
+        b = sortBitonic(b);
+    }
+
+    __attribute__((target("sse4.1"))) static Vector load(const Type* src)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    }
+
+    __attribute__((target("sse4.1"))) static void store(Type* dest, Vector v)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), v);
+    }
+};
+
+//Tail of a vector merge: WIDTH kept elements and the rest of both runs
+template <class Type, class Compare>
+void finishVectorMergeLow(const Type* kept, std::ptrdiff_t n_kept, const Type* left, const Type* left_finish,
+                          Type* right, Type* right_finish, Type* dest, Compare comp)
+{
+    const Type* kept_finish = kept + n_kept;
+    while (kept != kept_finish)
+    {
+        if (left != left_finish && !comp(*kept, *left) && (right == right_finish || !comp(*right, *left)))
+            *(dest++) = *(left++);
+        else if (right != right_finish && !comp(*kept, *right))
+            *(dest++) = *(right++);
+        else
+            *(dest++) = *(kept++);
+    }
+
+    branchlessMergeLow(left, left_finish, right, right_finish, dest, comp);
+}
+
+template <class Type, class Compare>
+void finishVectorMergeHigh(const Type* kept, std::ptrdiff_t n_kept, Type* left, Type* left_finish,
+                           const Type* right, const Type* right_finish, Type* dest_finish, Compare comp)
+{
+    const Type* kept_finish = kept + n_kept;
+    while (kept_finish != kept)
+    {
+        if (left_finish != left && !comp(*(left_finish - 1), *(kept_finish - 1)) &&
+            (right_finish == right || !comp(*(left_finish - 1), *(right_finish - 1))))
+            *(--dest_finish) = *(--left_finish);
+        else if (right_finish != right && !comp(*(right_finish - 1), *(kept_finish - 1)))
+            *(--dest_finish) = *(--right_finish);
+        else
+            *(--dest_finish) = *(--kept_finish);
+    }
+
+    branchlessMergeHigh(left, left_finish, right, right_finish, dest_finish, comp);
+}
+
+//Kernel loops, compiled separately for each instruction set: every step merges WIDTH new elements
+//taken from the run with the smaller head (larger tail for the high merge) with WIDTH elements
+//kept from the previous step
+template <class Kernel, class Compare>
+__attribute__((target("avx2"))) void avx2MergeLow(const typename Kernel::Type* left,
+                                                  const typename Kernel::Type* left_finish,
+                                                  typename Kernel::Type* right, typename Kernel::Type* right_finish,
+                                                  typename Kernel::Type* dest, Compare comp)
+{
+    typedef typename Kernel::Type Type;
+    typedef typename Kernel::Vector Vector;
+
+    Vector kept = Kernel::load(left);
+    left += Kernel::WIDTH;
+
+    while (left_finish - left >= Kernel::WIDTH && right_finish - right >= Kernel::WIDTH)
+    {
+        Vector next;
+        if (comp(*right, *left))
+        {
+            next = Kernel::load(right);
+            right += Kernel::WIDTH;
+        }
+        else
+        {
+            next = Kernel::load(left);
+            left += Kernel::WIDTH;
+        }
+
+        Kernel::merge(next, kept);
+        Kernel::store(dest, next);
+        dest += Kernel::WIDTH;
+    }
+
+    Type kept_elems[Kernel::WIDTH];
+    Kernel::store(kept_elems, kept);
+    finishVectorMergeLow(kept_elems, Kernel::WIDTH, left, left_finish, right, right_finish, dest, comp);
+}
+
+template <class Kernel, class Compare>
+__attribute__((target("avx2"))) void avx2MergeHigh(typename Kernel::Type* left, typename Kernel::Type* left_finish,
+                                                  const typename Kernel::Type* right,
+                                                  const typename Kernel::Type* right_finish,
+                                                  typename Kernel::Type* dest_finish, Compare comp)
+{
+    typedef typename Kernel::Type Type;
+    typedef typename Kernel::Vector Vector;
+
+    right_finish -= Kernel::WIDTH;
+    Vector kept = Kernel::load(right_finish);
+
+    while (left_finish - left >= Kernel::WIDTH && right_finish - right >= Kernel::WIDTH)
+    {
+        Vector next;
+        if (comp(*(right_finish - 1), *(left_finish - 1)))
+        {
+            left_finish -= Kernel::WIDTH;
+            next = Kernel::load(left_finish);
+        }
+        else
+        {
+            right_finish -= Kernel::WIDTH;
+            next = Kernel::load(right_finish);
+        }
+
+        Kernel::merge(kept, next);
+        dest_finish -= Kernel::WIDTH;
+        Kernel::store(dest_finish, next);
+    }
+
+    Type kept_elems[Kernel::WIDTH];
+    Kernel::store(kept_elems, kept);
+    finishVectorMergeHigh(kept_elems, Kernel::WIDTH, left, left_finish, right, right_finish, dest_finish, comp);
+}
+
+template <class Kernel, class Compare>
+__attribute__((target("sse4.1"))) void sse41MergeLow(const typename Kernel::Type* left,
+                                                     const typename Kernel::Type* left_finish,
+                                                     typename Kernel::Type* right, typename Kernel::Type* right_finish,
+                                                     typename Kernel::Type* dest, Compare comp)
+{
+    typedef typename Kernel::Type Type;
+    typedef typename Kernel::Vector Vector;
+
+    Vector kept = Kernel::load(left);
+    left += Kernel::WIDTH;
+
+    while (left_finish - left >= Kernel::WIDTH && right_finish - right >= Kernel::WIDTH)
+    {
+        Vector next;
+        if (comp(*right, *left))
+        {
+            next = Kernel::load(right);
+            right += Kernel::WIDTH;
+        }
+        else
+        {
+            next = Kernel::load(left);
+            left += Kernel::WIDTH;
+        }
+
+        Kernel::merge(next, kept);
+        Kernel::store(dest, next);
+        dest += Kernel::WIDTH;
+    }
+
+    Type kept_elems[Kernel::WIDTH];
+    Kernel::store(kept_elems, kept);
+    finishVectorMergeLow(kept_elems, Kernel::WIDTH, left, left_finish, right, right_finish, dest, comp);
+}
+
+template <class Kernel, class Compare>
+__attribute__((target("sse4.1"))) void sse41MergeHigh(typename Kernel::Type* left, typename Kernel::Type* left_finish,
+                                                     const typename Kernel::Type* right,
+                                                     const typename Kernel::Type* right_finish,
+                                                     typename Kernel::Type* dest_finish, Compare comp)
+{
+    typedef typename Kernel::Type Type;
+    typedef typename Kernel::Vector Vector;
+
+    right_finish -= Kernel::WIDTH;
+    Vector kept = Kernel::load(right_finish);
+
+    while (left_finish - left >= Kernel::WIDTH && right_finish - right >= Kernel::WIDTH)
+    {
+        Vector next;
+        if (comp(*(right_finish - 1), *(left_finish - 1)))
+        {
+            left_finish -= Kernel::WIDTH;
+            next = Kernel::load(left_finish);
+        }
+        else
+        {
+            right_finish -= Kernel::WIDTH;
+            next = Kernel::load(right_finish);
+        }
+
+        Kernel::merge(kept, next);
+        dest_finish -= Kernel::WIDTH;
+        Kernel::store(dest_finish, next);
+    }
+
+    Type kept_elems[Kernel::WIDTH];
+    Kernel::store(kept_elems, kept);
+    finishVectorMergeHigh(kept_elems, Kernel::WIDTH, left, left_finish, right, right_finish, dest_finish, comp);
+}
+
+#endif
+
+//0 - scalar only, 1 - 32-bit signed integer, 2 - 64-bit signed integer
+template <class Type>
+struct SimdMergeKind
+{
+    static const int value = (!std::is_integral<Type>::value || !std::is_signed<Type>::value) ? 0 :
+                             (sizeof(Type) == 4) ? 1 :
+                             (sizeof(Type) == 8) ? 2 : 0;
+};
+
+template <class Type, class Compare>
+void fastMergeLow(const Type* left, std::ptrdiff_t left_size, Type* right, std::ptrdiff_t right_size, Type* dest,
+                  Compare comp, std::integral_constant<int, 0>)
+{
+    branchlessMergeLow(left, left + left_size, right, right + right_size, dest, comp);
+}
+
+template <class Type, class Compare>
+void fastMergeLow(const Type* left, std::ptrdiff_t left_size, Type* right, std::ptrdiff_t right_size, Type* dest,
+                  Compare comp, std::integral_constant<int, 1>)
+{
+#ifdef TIMSORT_X86_SIMD
+    const bool DESCENDING = std::is_same<Compare, std::greater<Type>>::value;
+    const int32_t* left32 = reinterpret_cast<const int32_t*>(left);
+    int32_t* right32 = reinterpret_cast<int32_t*>(right);
+    int32_t* dest32 = reinterpret_cast<int32_t*>(dest);
+
+    if (cpuHasAvx2() && left_size >= 8)
+    {
+        avx2MergeLow<Avx2Int32Kernel<DESCENDING>>(left32, left32 + left_size, right32, right32 + right_size,
+                                                  dest32, comp);
+        return;
+    }
+    if (cpuHasSse41() && left_size >= 4)
+    {
+        sse41MergeLow<Sse41Int32Kernel<DESCENDING>>(left32, left32 + left_size, right32, right32 + right_size,
+                                                    dest32, comp);
+        return;
+    }
+#endif
+    branchlessMergeLow(left, left + left_size, right, right + right_size, dest, comp);
+}
+
+template <class Type, class Compare>
+void fastMergeLow(const Type* left, std::ptrdiff_t left_size, Type* right, std::ptrdiff_t right_size, Type* dest,
+                  Compare comp, std::integral_constant<int, 2>)
+{
+#ifdef TIMSORT_X86_SIMD
+    const bool DESCENDING = std::is_same<Compare, std::greater<Type>>::value;
+    const int64_t* left64 = reinterpret_cast<const int64_t*>(left);
+    int64_t* right64 = reinterpret_cast<int64_t*>(right);
+    int64_t* dest64 = reinterpret_cast<int64_t*>(dest);
+
+    if (cpuHasAvx2() && left_size >= 4)
+    {
+        avx2MergeLow<Avx2Int64Kernel<DESCENDING>>(left64, left64 + left_size, right64, right64 + right_size,
+                                                  dest64, comp);
+        return;
+    }
+#endif
+    branchlessMergeLow(left, left + left_size, right, right + right_size, dest, comp);
+}
+
+//Merges left, moved to a buffer, with right run placed right after dest + left_size. Right may be placed
+//further only if all of it goes before the last element of left, so none of it is left in place
+template <class Type, class Compare>
+void fastMergeLow(const Type* left, std::ptrdiff_t left_size, Type* right, std::ptrdiff_t right_size, Type* dest, Compare comp)
+{
+    fastMergeLow(left, left_size, right, right_size, dest, comp,
+                 std::integral_constant<int, SimdMergeKind<Type>::value>());
+}
+
+template <class Type, class Compare>
+void fastMergeHigh(Type* left, std::ptrdiff_t left_size, const Type* right, std::ptrdiff_t right_size, Type* dest_finish,
+                   Compare comp, std::integral_constant<int, 0>)
+{
+    branchlessMergeHigh(left, left + left_size, right, right + right_size, dest_finish, comp);
+}
+
+template <class Type, class Compare>
+void fastMergeHigh(Type* left, std::ptrdiff_t left_size, const Type* right, std::ptrdiff_t right_size, Type* dest_finish,
+                   Compare comp, std::integral_constant<int, 1>)
+{
+#ifdef TIMSORT_X86_SIMD
+    const bool DESCENDING = std::is_same<Compare, std::greater<Type>>::value;
+    int32_t* left32 = reinterpret_cast<int32_t*>(left);
+    const int32_t* right32 = reinterpret_cast<const int32_t*>(right);
+    int32_t* dest32 = reinterpret_cast<int32_t*>(dest_finish);
+
+    if (cpuHasAvx2() && right_size >= 8)
+    {
+        avx2MergeHigh<Avx2Int32Kernel<DESCENDING>>(left32, left32 + left_size, right32, right32 + right_size,
+                                                   dest32, comp);
+        return;
+    }
+    if (cpuHasSse41() && right_size >= 4)
+    {
+        sse41MergeHigh<Sse41Int32Kernel<DESCENDING>>(left32, left32 + left_size, right32, right32 + right_size,
+                                                     dest32, comp);
+        return;
+    }
+#endif
+    branchlessMergeHigh(left, left + left_size, right, right + right_size, dest_finish, comp);
+}
+
+template <class Type, class Compare>
+void fastMergeHigh(Type* left, std::ptrdiff_t left_size, const Type* right, std::ptrdiff_t right_size, Type* dest_finish,
+                   Compare comp, std::integral_constant<int, 2>)
+{
+#ifdef TIMSORT_X86_SIMD
+    const bool DESCENDING = std::is_same<Compare, std::greater<Type>>::value;
+    int64_t* left64 = reinterpret_cast<int64_t*>(left);
+    const int64_t* right64 = reinterpret_cast<const int64_t*>(right);
+    int64_t* dest64 = reinterpret_cast<int64_t*>(dest_finish);
+
+    if (cpuHasAvx2() && right_size >= 4)
+    {
+        avx2MergeHigh<Avx2Int64Kernel<DESCENDING>>(left64, left64 + left_size, right64, right64 + right_size,
+                                                   dest64, comp);
+        return;
+    }
+#endif
+    branchlessMergeHigh(left, left + left_size, right, right + right_size, dest_finish, comp);
+}
+
+//Merges left run with right, moved to a buffer, writing from the end of the right run backward
+template <class Type, class Compare>
+void fastMergeHigh(Type* left, std::ptrdiff_t left_size, const Type* right, std::ptrdiff_t right_size, Compare comp)
+{
+    fastMergeHigh(left, left_size, right, right_size, left + left_size + right_size, comp,
+                  std::integral_constant<int, SimdMergeKind<Type>::value>());
+}
+
+//The same, writing backward from dest_finish. It may be after left + left_size + right_size only if all
+//of left goes after the first element of right, so none of it is left in place
+template <class Type, class Compare>
+void fastMergeHigh(Type* left, std::ptrdiff_t left_size, const Type* right, std::ptrdiff_t right_size, Type* dest_finish,
+                   Compare comp)
+{
+    fastMergeHigh(left, left_size, right, right_size, dest_finish, comp,
+                  std::integral_constant<int, SimdMergeKind<Type>::value>());
+}
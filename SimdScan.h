@@ -0,0 +1,246 @@
+/*
+SimdScan.h
+Search for the end of a natural run
+1. Offers findAscendingRunEnd and findDescendingRunEnd for any iterators and comparators:
+   ascending runs are non-strict and take equal neighbours in, descending runs are strict,
+   so reversing them never changes the order of equal elements
+2. For 32/64-bit signed integers, float and double compared with std::less or std::greater
+   in contiguous memory, scans compare 4 or 8 neighbouring pairs per step with AVX2
+*/
+
+#pragma once
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include "SimdMerge.h"
+
+//0 - scalar only, 1 - int32, 2 - int64, 3 - float, 4 - double
+template <class Type>
+struct SimdScanKind
+{
+    static const int value = std::is_same<Type, float>::value ? 3 :
+                             std::is_same<Type, double>::value ? 4 :
+                             SimdMergeKind<Type>::value;
+};
+
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator scalarAscendingRunEnd(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    if (start == finish)
+        return finish;
+
+    RandomAccessIterator curr = start + 1;
+    while (curr != finish && !comp(*curr, *(curr - 1)))
+        curr++;
+    return curr;
+}
+
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator scalarDescendingRunEnd(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    if (start == finish)
+        return finish;
+
+    RandomAccessIterator curr = start + 1;
+    while (curr != finish && comp(*curr, *(curr - 1)))
+        curr++;
+    return curr;
+}
+
+template <class Type, bool Increasing, bool Strict>
+bool continuesRun(const Type& prev, const Type& next)
+{
+    if (Strict)
+        return Increasing ? prev < next : next < prev;
+    return Increasing ? !(next < prev) : !(prev < next);
+}
+
+#ifdef TIMSORT_X86_SIMD
+
+//Masks have bit i set when element i is strictly less (greater) than element i + 1
+template <class Type>
+struct Avx2ScanKernel;
+
+template <>
+struct Avx2ScanKernel<int32_t>
+{
+    static const int WIDTH = 8;
+
+    __attribute__((target("avx2"))) static int increasingMask(const int32_t* p)
+    {
+        __m256i curr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(next, curr)));
+    }
+
+    __attribute__((target("avx2"))) static int decreasingMask(const int32_t* p)
+    {
+        __m256i curr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(curr, next)));
+    }
+};
+
+template <>
+struct Avx2ScanKernel<int64_t>
+{
+    static const int WIDTH = 4;
+
+    __attribute__((target("avx2"))) static int increasingMask(const int64_t* p)
+    {
+        __m256i curr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(next, curr)));
+    }
+
+    __attribute__((target("avx2"))) static int decreasingMask(const int64_t* p)
+    {
+        __m256i curr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(curr, next)));
+    }
+};
+
+template <>
+struct Avx2ScanKernel<float>
+{
+    static const int WIDTH = 8;
+
+    __attribute__((target("avx2"))) static int increasingMask(const float* p)
+    {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 1), _CMP_LT_OQ));
+    }
+
+    __attribute__((target("avx2"))) static int decreasingMask(const float* p)
+    {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 1), _CMP_GT_OQ));
+    }
+};
+
+template <>
+struct Avx2ScanKernel<double>
+{
+    static const int WIDTH = 4;
+
+    __attribute__((target("avx2"))) static int increasingMask(const double* p)
+    {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p), _mm256_loadu_pd(p + 1), _CMP_LT_OQ));
+    }
+
+    __attribute__((target("avx2"))) static int decreasingMask(const double* p)
+    {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p), _mm256_loadu_pd(p + 1), _CMP_GT_OQ));
+    }
+};
+
+//A non-strict run continues while the opposite strict mask has no bit set
+template <class Type, bool Increasing, bool Strict>
+__attribute__((target("avx2"))) const Type* avx2RunEnd(const Type* start, const Type* finish)
+{
+    typedef Avx2ScanKernel<Type> Kernel;
+    const int FULL_MASK = (1 << Kernel::WIDTH) - 1;
+
+    const Type* curr = start;
+    while (finish - curr > Kernel::WIDTH)
+    {
+        int mask = Strict ? (Increasing ? Kernel::increasingMask(curr) : Kernel::decreasingMask(curr)) :
+                            FULL_MASK & ~(Increasing ? Kernel::decreasingMask(curr) : Kernel::increasingMask(curr));
+        if (mask != FULL_MASK)
+            return curr + __builtin_ctz(~mask) + 1;
+        curr += Kernel::WIDTH;
+    }
+
+    while (curr + 1 < finish && continuesRun<Type, Increasing, Strict>(*curr, *(curr + 1)))
+        curr++;
+    return curr + 1;
+}
+
+#endif
+
+template <class Type, bool Increasing, bool Strict>
+const Type* numericRunEnd(const Type* start, const Type* finish, std::integral_constant<int, 0>)
+{
+    if (start == finish)
+        return finish;
+
+    const Type* curr = start + 1;
+    while (curr != finish && continuesRun<Type, Increasing, Strict>(*(curr - 1), *curr))
+        curr++;
+    return curr;
+}
+
+template <class Type, bool Increasing, bool Strict, int Kind>
+const Type* numericRunEnd(const Type* start, const Type* finish, std::integral_constant<int, Kind>)
+{
+#ifdef TIMSORT_X86_SIMD
+    typedef typename std::conditional<Kind == 1, int32_t,
+            typename std::conditional<Kind == 2, int64_t,
+            typename std::conditional<Kind == 3, float, double>::type>::type>::type KernelType;
+
+    if (cpuHasAvx2() && finish - start > 1)
+    {
+        const KernelType* kernel_start = reinterpret_cast<const KernelType*>(start);
+        const KernelType* kernel_finish = reinterpret_cast<const KernelType*>(finish);
+        return start + (avx2RunEnd<KernelType, Increasing, Strict>(kernel_start, kernel_finish) - kernel_start);
+    }
+#endif
+    return numericRunEnd<Type, Increasing, Strict>(start, finish, std::integral_constant<int, 0>());
+}
+
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator findRunEnd(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                                bool ascending, std::false_type)
+{
+    if (ascending)
+        return scalarAscendingRunEnd(start, finish, comp);
+    return scalarDescendingRunEnd(start, finish, comp);
+}
+
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator findRunEnd(RandomAccessIterator start, RandomAccessIterator finish, Compare,
+                                bool ascending, std::true_type)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    typedef std::integral_constant<int, SimdScanKind<ValueType>::value> Kind;
+
+    if (start == finish)
+        return finish;
+
+    //Ascending for std::greater means numerically decreasing, only descending runs are strict
+    bool increasing = (ascending == std::is_same<Compare, std::less<ValueType>>::value);
+    const ValueType* raw_start = &*start;
+    const ValueType* raw_finish = raw_start + (finish - start);
+    const ValueType* raw_end;
+    if (ascending)
+        raw_end = increasing ? numericRunEnd<ValueType, true, false>(raw_start, raw_finish, Kind()) :
+                               numericRunEnd<ValueType, false, false>(raw_start, raw_finish, Kind());
+    else
+        raw_end = increasing ? numericRunEnd<ValueType, true, true>(raw_start, raw_finish, Kind()) :
+                               numericRunEnd<ValueType, false, true>(raw_start, raw_finish, Kind());
+    return start + (raw_end - raw_start);
+}
+
+template <class RandomAccessIterator, class Compare>
+struct IsSimdScannable
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    static const bool value = IsBranchlessMergeable<ValueType, Compare>::value &&
+                              IsContiguousIterator<RandomAccessIterator>::value &&
+                              SimdScanKind<ValueType>::value != 0;
+};
+
+//End of the run starting at start where no element is less (in terms of comp) than the previous
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator findAscendingRunEnd(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    return findRunEnd(start, finish, comp, true,
+                      std::integral_constant<bool, IsSimdScannable<RandomAccessIterator, Compare>::value>());
+}
+
+//End of the run starting at start where every element is strictly less (in terms of comp) than the previous
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator findDescendingRunEnd(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    return findRunEnd(start, finish, comp, false,
+                      std::integral_constant<bool, IsSimdScannable<RandomAccessIterator, Compare>::value>());
+}
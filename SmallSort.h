@@ -0,0 +1,208 @@
+/*
+SmallSort.h
+Sorting of short array parts, used to build runs of minRun length
+1. Offers binaryInsertionSort: binary search of position and a single move-shift per element
+2. Offers compile-time generated Batcher odd-even merge networks with branchless compare-exchange
+3. Offers smallSort choosing networks for integral types with std::less/std::greater
+   and binary insertion otherwise
+*/
+
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+const int MAX_NETWORK_SIZE = 32;
+
+template <class RandomAccessIterator, class Compare>
+void binaryInsertionSort(RandomAccessIterator start, RandomAccessIterator sorted_finish,
+                         RandomAccessIterator finish, Compare comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+
+    if (sorted_finish == start)
+        sorted_finish++;
+
+    for (RandomAccessIterator curr = sorted_finish; curr < finish; curr++)
+    {
+        //Position after all elements equal to *curr keeps the sort stable
+        RandomAccessIterator left = start, right = curr;
+        while (left < right)
+        {
+            RandomAccessIterator med = left + (right - left) / 2;
+            if (comp(*curr, *med))
+                right = med;
+            else
+                left = med + 1;
+        }
+
+        if (left == curr)
+            continue;
+
+        ValueType to_insert = std::move(*curr);
+        std::move_backward(left, curr, curr + 1);
+        *left = std::move(to_insert);
+    }
+}
+
+template <class RandomAccessIterator, class Compare>
+void binaryInsertionSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    if (start == finish)
+        return;
+
+    RandomAccessIterator sorted_finish = start + 1;
+    while (sorted_finish != finish && !comp(*sorted_finish, *(sorted_finish - 1)))
+        sorted_finish++;
+
+    binaryInsertionSort(start, sorted_finish, finish, comp);
+}
+
+template <class Type, class Compare>
+struct IsNetworkSortable
+{
+    static const bool value = std::is_integral<Type>::value &&
+                              (std::is_same<Compare, std::less<Type>>::value ||
+                               std::is_same<Compare, std::greater<Type>>::value);
+};
+
+template <class Type, class Compare>
+inline void compareExchange(Type& a, Type& b, Compare comp)
+{
+    bool need_swap = comp(b, a);
+    Type low = need_swap ? b : a;
+    Type high = need_swap ? a : b;
+    a = low;
+    b = high;
+}
+
+//Comparators touching positions >= Limit are dropped: it is the same as padding the array with maximums
+template <int Lo, int N, int Step, int Limit, bool Last = (Step * 2 >= N)>
+struct OddEvenMerge
+{
+    template <class RandomAccessIterator, class Compare>
+    static void apply(RandomAccessIterator arr, Compare comp)
+    {
+        OddEvenMerge<Lo, N, Step * 2, Limit>::apply(arr, comp);
+        OddEvenMerge<Lo + Step, N, Step * 2, Limit>::apply(arr, comp);
+
+        for (int i = Lo + Step; i + Step < Lo + N; i += Step * 2)
+        {
+            if (i + Step < Limit)
+                compareExchange(arr[i], arr[i + Step], comp);
+        }
+    }
+};
+
+template <int Lo, int N, int Step, int Limit>
+struct OddEvenMerge<Lo, N, Step, Limit, true>
+{
+    template <class RandomAccessIterator, class Compare>
+    static void apply(RandomAccessIterator arr, Compare comp)
+    {
+        if (Lo + Step < Limit)
+            compareExchange(arr[Lo], arr[Lo + Step], comp);
+    }
+};
+
+template <int Lo, int N, int Limit, bool Trivial = (N <= 1 || Lo >= Limit)>
+struct OddEvenMergeSort
+{
+    template <class RandomAccessIterator, class Compare>
+    static void apply(RandomAccessIterator arr, Compare comp)
+    {
+        OddEvenMergeSort<Lo, N / 2, Limit>::apply(arr, comp);
+        OddEvenMergeSort<Lo + N / 2, N / 2, Limit>::apply(arr, comp);
+        OddEvenMerge<Lo, N, 1, Limit>::apply(arr, comp);
+    }
+};
+
+template <int Lo, int N, int Limit>
+struct OddEvenMergeSort<Lo, N, Limit, true>
+{
+    template <class RandomAccessIterator, class Compare>
+    static void apply(RandomAccessIterator, Compare) {}
+};
+
+//Chooses the network generated for exactly n elements
+template <int Size>
+struct NetworkSorter
+{
+    template <class RandomAccessIterator, class Compare>
+    static void apply(RandomAccessIterator arr, int n, Compare comp)
+    {
+        if (n == Size)
+            OddEvenMergeSort<0, MAX_NETWORK_SIZE, Size>::apply(arr, comp);
+        else
+            NetworkSorter<Size - 1>::apply(arr, n, comp);
+    }
+};
+
+template <>
+struct NetworkSorter<1>
+{
+    template <class RandomAccessIterator, class Compare>
+    static void apply(RandomAccessIterator, int, Compare) {}
+};
+
+template <class RandomAccessIterator, class Compare>
+void networkSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    int arr_size = static_cast<int>(finish - start);
+
+    if (arr_size <= MAX_NETWORK_SIZE)
+    {
+        NetworkSorter<MAX_NETWORK_SIZE>::apply(start, arr_size, comp);
+        return;
+    }
+
+    //Two networks and a branchless merge through a stack buffer cover runs up to 2 * MAX_NETWORK_SIZE
+    int left_size = arr_size / 2;
+    NetworkSorter<MAX_NETWORK_SIZE>::apply(start, left_size, comp);
+    NetworkSorter<MAX_NETWORK_SIZE>::apply(start + left_size, arr_size - left_size, comp);
+
+    ValueType buffer[MAX_NETWORK_SIZE];
+    std::copy(start, start + left_size, buffer);
+
+    int left = 0;
+    RandomAccessIterator right = start + left_size;
+    RandomAccessIterator dest = start;
+    while (left < left_size && right != finish)
+    {
+        bool take_right = comp(*right, buffer[left]);
+        *(dest++) = take_right ? *right : buffer[left];
+        right += take_right;
+        left += !take_right;
+    }
+    std::copy(buffer + left, buffer + left_size, dest);
+}
+
+template <class RandomAccessIterator, class Compare>
+void smallSort(RandomAccessIterator start, RandomAccessIterator sorted_finish,
+               RandomAccessIterator finish, Compare comp, std::true_type)
+{
+    if (finish - start <= 2 * MAX_NETWORK_SIZE && finish - sorted_finish > 1)
+        networkSort(start, finish, comp);
+    else
+        binaryInsertionSort(start, sorted_finish, finish, comp);
+}
+
+template <class RandomAccessIterator, class Compare>
+void smallSort(RandomAccessIterator start, RandomAccessIterator sorted_finish,
+               RandomAccessIterator finish, Compare comp, std::false_type)
+{
+    binaryInsertionSort(start, sorted_finish, finish, comp);
+}
+
+//Sorts [start, finish) where [start, sorted_finish) is already sorted
+template <class RandomAccessIterator, class Compare>
+void smallSort(RandomAccessIterator start, RandomAccessIterator sorted_finish,
+               RandomAccessIterator finish, Compare comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type ValueType;
+    smallSort(start, sorted_finish, finish, comp,
+              std::integral_constant<bool, IsNetworkSortable<ValueType, Compare>::value>());
+}
@@ -0,0 +1,103 @@
+/*
+StringSort.h
+Sorting of strings in lexicographic order with cached key prefixes
+1. Offers timSortStrings for ranges of std::string or any type with data() and size() over char:
+   the first 8 bytes of every string are kept big-endian in an integer next to its length,
+   so most comparisons are one integer comparison and do not touch string bodies
+2. Bytes common to all strings of the range are skipped first, so the cached prefix
+   starts where strings like URLs of one site begin to differ
+3. Prefixes are sorted by timSortByKey and strings are moved once at the end;
+   on equal prefixes only the bytes after the prefix are compared
+Equal strings keep their order
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "KeySort.h"
+
+const size_t STRING_PREFIX_BYTES = sizeof(std::uint64_t);
+
+struct StringPrefixKey
+{
+    //Bytes past the end of a short string are zero
+    std::uint64_t prefix;
+    const char* data;
+    size_t length;
+};
+
+//Keys of strings without their first skipped_length bytes
+class StringPrefixProjection
+{
+public:
+    explicit StringPrefixProjection(size_t skipped_length):
+        skipped_length (skipped_length)
+
+        {}
+
+    template <class String>
+    StringPrefixKey operator ()(const String& str) const
+    {
+        StringPrefixKey key = {0, str.data() + skipped_length, static_cast<size_t>(str.size()) - skipped_length};
+        size_t n_prefix_bytes = (key.length < STRING_PREFIX_BYTES) ? key.length : STRING_PREFIX_BYTES;
+        for (size_t i = 0; i < n_prefix_bytes; i++)
+            key.prefix |= static_cast<std::uint64_t>(static_cast<unsigned char>(key.data[i])) << (56 - 8 * i);
+        return key;
+    }
+
+private:
+    size_t skipped_length;
+};
+
+//The same order as std::less<std::string>: bytes compared as unsigned, a proper prefix goes first
+class CompareStringPrefixKeys
+{
+public:
+    bool operator ()(const StringPrefixKey& a, const StringPrefixKey& b) const
+    {
+        if (a.prefix != b.prefix)
+            return (a.prefix < b.prefix);
+
+        //Equal prefixes: the first bytes are already matched
+        size_t common_length = (a.length < b.length) ? a.length : b.length;
+        if (common_length > STRING_PREFIX_BYTES)
+        {
+            int order = memcmp(a.data + STRING_PREFIX_BYTES, b.data + STRING_PREFIX_BYTES,
+                               common_length - STRING_PREFIX_BYTES);
+            if (order != 0)
+                return (order < 0);
+        }
+        return (a.length < b.length);
+    }
+};
+
+//Length of the longest prefix shared by all strings of the range
+template <class RandomAccessIterator>
+size_t getCommonPrefixLength(RandomAccessIterator start, RandomAccessIterator finish)
+{
+    if (start == finish)
+        return 0;
+
+    const char* first_data = start->data();
+    size_t common_length = start->size();
+    for (RandomAccessIterator it = start + 1; it != finish && common_length > 0; ++it)
+    {
+        if (static_cast<size_t>(it->size()) < common_length)
+            common_length = it->size();
+        const char* data = it->data();
+        size_t matched = 0;
+        while (matched < common_length && data[matched] == first_data[matched])
+            matched++;
+        common_length = matched;
+    }
+    return common_length;
+}
+
+template <class RandomAccessIterator>
+void timSortStrings(RandomAccessIterator start, RandomAccessIterator finish,
+                    const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    timSortByKey(start, finish, StringPrefixProjection(getCommonPrefixLength(start, finish)),
+                 CompareStringPrefixKeys(), params);
+}
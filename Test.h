@@ -1,9 +1,21 @@
 
 #include "TimSort.h"
+#include "ParallelTimSort.h"
+#include "TimSortedBuffer.h"
+#include "ExternalTimSort.h"
+#include "KeySort.h"
+#include "StringSort.h"
+#include "RadixSort.h"
+#include "BatchTimSort.h"
+#include "KWayMerge.h"
+#include "TimSorter.h"
+#include "PartialSort.h"
+#include "FewKeysSort.h"
 #include <algorithm>
 #include <string>
 #include <ctime>
 #include <iostream>
+#include <memory>
 
 using std::vector;
 using std::string;
@@ -38,6 +50,26 @@ public:
     }
 };
 
+class KeyIndex
+{
+public:
+    int key, index;
+
+    bool operator == (const KeyIndex& that) const
+    {
+        return (key == that.key && index == that.index);
+    }
+};
+
+class CompareKeyFunctor
+{
+public:
+    bool operator ()(const KeyIndex& a, const KeyIndex& b) const
+    {
+        return (a.key < b.key);
+    }
+};
+
 class ComparePointFunctor
 {
 public:
@@ -47,6 +79,36 @@ public:
     }
 };
 
+class CompareIntPtrFunctor
+{
+public:
+    bool operator ()(const std::unique_ptr<int>& p1, const std::unique_ptr<int>& p2) const
+    {
+        return (*p1 < *p2);
+    }
+};
+
+//Has no default constructor, so sorts may only create elements from the given ones
+class NoDefaultInt
+{
+public:
+    explicit NoDefaultInt(int value):
+        value (value)
+
+        {}
+
+    int value;
+};
+
+class CompareNoDefaultFunctor
+{
+public:
+    bool operator ()(const NoDefaultInt& a, const NoDefaultInt& b) const
+    {
+        return (a.value < b.value);
+    }
+};
+
 bool comparePointsFunction(Point3D& p1, Point3D& p2)
 {
     return (p1.x > p2.x);
@@ -60,6 +122,27 @@ void createRandomIntArray(vector<int>& arr, int len)
         arr[i] = rand() % MAX_INT;
 }
 
+template <class Type>
+void createRandomArithmeticArray(vector<Type>& arr, int len)
+{
+    arr = vector<Type>(len);
+
+    for (int i = 0; i < len; i++)
+        arr[i] = static_cast<Type>(rand() % MAX_INT - MAX_INT / 2) / static_cast<Type>(1 + rand() % 3);
+}
+
+void createSortedIntArray(vector<int>& arr, int len)
+{
+    createRandomIntArray(arr, len);
+    std::sort(arr.begin(), arr.end());
+}
+
+void createReversedIntArray(vector<int>& arr, int len)
+{
+    createSortedIntArray(arr, len);
+    std::reverse(arr.begin(), arr.end());
+}
+
 void createPartiallySorted(vector<int>& arr, int len)
 {
     createRandomIntArray(arr, len);
@@ -97,11 +180,78 @@ string createRandomString()
     return str;
 }
 
+class MergeBudgetParams : public IDefaultTimSortParams
+{
+public:
+    explicit MergeBudgetParams(size_t budget_bytes):
+        budget (budget_bytes)
+
+        {}
+
+    virtual size_t getMergeBufferBudget() const
+    {
+        return budget;
+    }
+
+private:
+    size_t budget;
+};
+
+//Runs shorter than the default minRun are merged, without a buffer, so in place
+class ShortRunParams : public MergeBudgetParams
+{
+public:
+    ShortRunParams():
+        MergeBudgetParams(NO_MERGE_BUFFER)
+
+        {}
+
+    virtual std::ptrdiff_t minRun(std::ptrdiff_t) const
+    {
+        return 8;
+    }
+};
+
+//Overrides only the members ITimSortParams had at first, the others keep their defaults
+class LegacyParams : public ITimSortParams
+{
+public:
+    virtual std::ptrdiff_t minRun(std::ptrdiff_t n) const
+    {
+        return DefaultTimSortPolicy::minRun(n);
+    }
+
+    virtual bool needMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y) const
+    {
+        return DefaultTimSortPolicy::needMerge(len_x, len_y);
+    }
+
+    virtual EWhatMerge whatMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y, std::ptrdiff_t len_z) const
+    {
+        return DefaultTimSortPolicy::whatMerge(len_x, len_y, len_z);
+    }
+
+    virtual int getGallop() const
+    {
+        return DefaultTimSortPolicy::getGallop();
+    }
+};
+
+class InplaceMergePolicy : public DefaultTimSortPolicy
+{
+public:
+    static size_t getMergeBufferBudget()
+    {
+        return NO_MERGE_BUFFER;
+    }
+};
+
 template <class RandomAccessIterator, class Compare>
-clock_t getTimSortTime(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+clock_t getTimSortTime(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                       const ITimSortParams& params = DEFAULT_PARAMS)
 {
     clock_t start_time = clock();
-    timSort(start, finish, comp);
+    timSort(start, finish, comp, params);
     return clock() - start_time;
 }
 
@@ -137,7 +287,8 @@ bool isEqualArrays(vector<Type>& arr1, vector<Type>& arr2)
 };
 
 template <class Type, class Generator, class Compare>
-void testGenerator(Type val_example, vector<int> lens, Generator gen, Compare comp)
+void testGenerator(Type val_example, vector<int> lens, Generator gen, Compare comp,
+                   const ITimSortParams& params = DEFAULT_PARAMS)
 {
     cout << "Testing:\n";
     for (size_t len_i = 0; len_i < lens.size(); len_i++)
@@ -147,7 +298,7 @@ void testGenerator(Type val_example, vector<int> lens, Generator gen, Compare co
         vector<Type> arr_std(arr_tim.begin(), arr_tim.end());
 
         cout << "    For len " << lens[len_i] << ":\n";
-        cout << "    TimSortTime: " << getTimSortTime(arr_tim.begin(), arr_tim.end(), comp);
+        cout << "    TimSortTime: " << getTimSortTime(arr_tim.begin(), arr_tim.end(), comp, params);
         cout << "    StdSortTime: " << getStdSortTime(arr_std.begin(), arr_std.end(), comp);
 
         if (isEqualArrays(arr_tim, arr_std))
@@ -196,4 +347,925 @@ void testPartiallySorted()
 {
     const int INT_EXAMPLE = 2;
     testGenerator(INT_EXAMPLE, vector<int>(LENS, LENS + N_DIFFERENT_LENS), createPartiallySorted, std::less<int>());
-}
\ No newline at end of file
+}
+
+void testMergeBudgets()
+{
+    const int INT_EXAMPLE = 2;
+    const size_t BUDGETS[] = {NO_MERGE_BUFFER, 16 * sizeof(int), 1024 * sizeof(int), UNLIMITED_MERGE_BUFFER};
+
+    for (size_t i = 0; i < sizeof(BUDGETS) / sizeof(BUDGETS[0]); i++)
+    {
+        cout << "Merge buffer budget " << BUDGETS[i] << " bytes\n";
+        testGenerator(INT_EXAMPLE, vector<int>(LENS, LENS + N_DIFFERENT_LENS), createPartiallySorted,
+                      std::less<int>(), MergeBudgetParams(BUDGETS[i]));
+    }
+}
+
+void testSmallRuns()
+{
+    const int INT_EXAMPLE = 2;
+    vector<int> lens;
+    for (int len = 1; len <= 2 * MAX_MIN_RUN_LENGTH; len++)
+        lens.push_back(len);
+
+    testGenerator(INT_EXAMPLE, lens, createRandomIntArray, std::less<int>());
+    testGenerator(INT_EXAMPLE, lens, createRandomIntArray, std::greater<int>());
+}
+
+void testMoveOnly()
+{
+    cout << "Testing move-only elements and elements without a default constructor:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<int> values;
+        createRandomIntArray(values, LENS[len_i]);
+        vector<std::unique_ptr<int>> arr(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            arr[i].reset(new int(values[i]));
+
+        vector<NoDefaultInt> no_default;
+        for (size_t i = 0; i < values.size(); i++)
+            no_default.push_back(NoDefaultInt(values[i]));
+
+        timSort(arr.begin(), arr.end(), CompareIntPtrFunctor());
+        timSort(no_default.begin(), no_default.end(), CompareNoDefaultFunctor(), LegacyParams());
+        std::sort(values.begin(), values.end());
+
+        bool succeeded = true;
+        for (size_t i = 0; i < values.size(); i++)
+            succeeded = succeeded && (*arr[i] == values[i]) && (no_default[i].value == values[i]);
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (succeeded)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+template <class Policy>
+void testPolicy()
+{
+    cout << "Testing static policy:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<int> arr_tim;
+        createPartiallySorted(arr_tim, LENS[len_i]);
+        vector<int> arr_std(arr_tim.begin(), arr_tim.end());
+
+        timSort<Policy>(arr_tim.begin(), arr_tim.end());
+        std::sort(arr_std.begin(), arr_std.end());
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (isEqualArrays(arr_tim, arr_std))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testStaticPolicies()
+{
+    testPolicy<DefaultTimSortPolicy>();
+    testPolicy<InplaceMergePolicy>();
+    testPolicy<PowersortPolicy>();
+}
+
+template <class Type, class Generator, class Compare>
+void testParallelGenerator(Type val_example, vector<int> lens, Generator gen, Compare comp, TimSortThreadPool& pool)
+{
+    cout << "Testing parallel sort with " << pool.getThreadsNumber() << " threads:\n";
+    for (size_t len_i = 0; len_i < lens.size(); len_i++)
+    {
+        vector<Type> arr_parallel;
+        gen(arr_parallel, lens[len_i]);
+        vector<Type> arr_tim(arr_parallel.begin(), arr_parallel.end());
+
+        parallelTimSort(arr_parallel.begin(), arr_parallel.end(), comp, pool);
+        timSort(arr_tim.begin(), arr_tim.end(), comp);
+
+        cout << "    For len " << lens[len_i] << ":";
+        if (isEqualArrays(arr_parallel, arr_tim))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testParallel()
+{
+    const int INT_EXAMPLE = 2;
+    const string STR_EXAMPLE = "abacaba";
+    const int N_THREADS[] = {1, 3, 4};
+    vector<int> lens(LENS, LENS + N_DIFFERENT_LENS);
+    lens.push_back(1000000);
+
+    for (size_t i = 0; i < sizeof(N_THREADS) / sizeof(N_THREADS[0]); i++)
+    {
+        TimSortThreadPool pool(N_THREADS[i]);
+        testParallelGenerator(INT_EXAMPLE, lens, createRandomIntArray, std::less<int>(), pool);
+        testParallelGenerator(INT_EXAMPLE, lens, createPartiallySorted, std::less<int>(), pool);
+        testParallelGenerator(STR_EXAMPLE, vector<int>(LENS, LENS + N_DIFFERENT_LENS), createRandomStringArray,
+                              std::less<string>(), pool);
+    }
+}
+
+void testArithmeticTypes()
+{
+    const int INT_EXAMPLE = 2;
+    const long long LONG_EXAMPLE = 2;
+    const double DOUBLE_EXAMPLE = 2.0;
+    const float FLOAT_EXAMPLE = 2.0f;
+    vector<int> lens(LENS, LENS + N_DIFFERENT_LENS);
+
+    testGenerator(LONG_EXAMPLE, lens, createRandomArithmeticArray<long long>, std::less<long long>());
+    testGenerator(LONG_EXAMPLE, lens, createRandomArithmeticArray<long long>, std::greater<long long>());
+    testGenerator(DOUBLE_EXAMPLE, lens, createRandomArithmeticArray<double>, std::less<double>());
+    testGenerator(FLOAT_EXAMPLE, lens, createRandomArithmeticArray<float>, std::greater<float>());
+    testGenerator(INT_EXAMPLE, lens, createRandomIntArray, std::greater<int>());
+}
+
+void testSortedInputs()
+{
+    const int INT_EXAMPLE = 2;
+    vector<int> lens(LENS, LENS + N_DIFFERENT_LENS);
+
+    testGenerator(INT_EXAMPLE, lens, createSortedIntArray, std::less<int>());
+    testGenerator(INT_EXAMPLE, lens, createReversedIntArray, std::less<int>());
+    testGenerator(INT_EXAMPLE, lens, createSortedIntArray, std::greater<int>());
+    testGenerator(INT_EXAMPLE, lens, createReversedIntArray, std::greater<int>());
+}
+
+void createFewUniqueKeyIndexArray(vector<KeyIndex>& arr, int len)
+{
+    const int N_UNIQUE_KEYS = 10;
+    arr = vector<KeyIndex>(len);
+
+    for (int i = 0; i < len; i++)
+    {
+        arr[i].key = rand() % N_UNIQUE_KEYS;
+        arr[i].index = i;
+    }
+
+    for (int k = 0; k < N_RANDOM_SORTS && len > 0; k++)
+    {
+        int start = rand() % len;
+        int finish = start + rand() % (len - start + 1);
+        std::stable_sort(arr.begin() + start, arr.begin() + finish, CompareKeyFunctor());
+    }
+}
+
+void testParallelStability()
+{
+    const int N_THREADS[] = {3, 4};
+    const MergeBudgetParams NO_BUFFER(NO_MERGE_BUFFER);
+    vector<int> lens(LENS, LENS + N_DIFFERENT_LENS);
+    lens.push_back(1000000);
+
+    for (size_t i = 0; i < sizeof(N_THREADS) / sizeof(N_THREADS[0]); i++)
+    {
+        TimSortThreadPool pool(N_THREADS[i]);
+        cout << "Testing parallel sort stability with " << pool.getThreadsNumber() << " threads:\n";
+        for (size_t len_i = 0; len_i < lens.size(); len_i++)
+        {
+            //Random and nearly sorted inputs with the buffer are compared with std::stable_sort. Without it
+            //the sequential merge is in-place and unstable, so only the order of keys is checked
+            vector<KeyIndex> arr, arr_nearly;
+            createFewUniqueKeyIndexArray(arr, lens[len_i]);
+            vector<KeyIndex> arr_std(arr);
+            std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+            arr_nearly = arr_std;
+            for (int k = 0; k < 10 && !arr_nearly.empty(); k++)
+                std::swap(arr_nearly[rand() % arr_nearly.size()], arr_nearly[rand() % arr_nearly.size()]);
+            vector<KeyIndex> arr_nearly_std(arr_nearly), arr_no_buffer(arr);
+            std::stable_sort(arr_nearly_std.begin(), arr_nearly_std.end(), CompareKeyFunctor());
+
+            parallelTimSort(arr.begin(), arr.end(), CompareKeyFunctor(), pool);
+            parallelTimSort(arr_nearly.begin(), arr_nearly.end(), CompareKeyFunctor(), pool);
+            parallelTimSort(arr_no_buffer.begin(), arr_no_buffer.end(), CompareKeyFunctor(), pool, NO_BUFFER);
+
+            bool keys_sorted = true;
+            for (size_t k = 0; k < arr_no_buffer.size(); k++)
+                keys_sorted = keys_sorted && (arr_no_buffer[k].key == arr_std[k].key);
+
+            cout << "    For len " << lens[len_i] << ":";
+            if (isEqualArrays(arr, arr_std) && isEqualArrays(arr_nearly, arr_nearly_std) && keys_sorted)
+                cout << "    Test succeeded\n";
+            else
+                cout << "    Sorry, test failed\n";
+        }
+    }
+}
+
+void testStability()
+{
+    const size_t BUDGETS[] = {16 * sizeof(KeyIndex), UNLIMITED_MERGE_BUFFER};
+
+    cout << "Testing stability:\n";
+    for (size_t i = 0; i < sizeof(BUDGETS) / sizeof(BUDGETS[0]); i++)
+    {
+        for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+        {
+            vector<KeyIndex> arr_tim;
+            createFewUniqueKeyIndexArray(arr_tim, LENS[len_i]);
+            vector<KeyIndex> arr_std(arr_tim.begin(), arr_tim.end());
+
+            timSort(arr_tim.begin(), arr_tim.end(), CompareKeyFunctor(), MergeBudgetParams(BUDGETS[i]));
+            std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+            cout << "    For len " << LENS[len_i] << ", budget " << BUDGETS[i] << ":";
+            if (isEqualArrays(arr_tim, arr_std))
+                cout << "    Test succeeded\n";
+            else
+                cout << "    Sorry, test failed\n";
+        }
+    }
+}
+void testInplaceMerge()
+{
+    const int SIZES[] = {1, 2, 7, 31, 100, 1000, 10000};
+    const int N_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
+
+    cout << "Testing in-place merge:\n";
+    for (int i = 0; i < N_SIZES; i++)
+    {
+        for (int j = 0; j < N_SIZES; j++)
+        {
+            vector<KeyIndex> arr;
+            createFewUniqueKeyIndexArray(arr, SIZES[i] + SIZES[j]);
+            std::stable_sort(arr.begin(), arr.begin() + SIZES[i], CompareKeyFunctor());
+            std::stable_sort(arr.begin() + SIZES[i], arr.end(), CompareKeyFunctor());
+
+            vector<KeyIndex> arr_sym(arr.begin(), arr.end());
+            vector<KeyIndex> arr_std(arr.begin(), arr.end());
+            std::inplace_merge(arr_std.begin(), arr_std.begin() + SIZES[i], arr_std.end(), CompareKeyFunctor());
+
+            //SymMerge is stable, the block merge only has to produce the same keys
+            symMerge(arr_sym.begin(), arr_sym.begin() + SIZES[i], arr_sym.end(), CompareKeyFunctor());
+            Run<vector<KeyIndex>::iterator> left = {arr.begin(), SIZES[i]};
+            Run<vector<KeyIndex>::iterator> right = {arr.begin() + SIZES[i], SIZES[j]};
+            inplaceMerge(left, right, CompareKeyFunctor());
+
+            bool succeeded = isEqualArrays(arr_sym, arr_std);
+            for (size_t k = 0; k < arr.size(); k++)
+                succeeded = succeeded && (arr[k].key == arr_std[k].key);
+
+            cout << "    For lens " << SIZES[i] << " and " << SIZES[j] << ":";
+            if (succeeded)
+                cout << "    Test succeeded\n";
+            else
+                cout << "    Sorry, test failed\n";
+        }
+    }
+}
+
+void testPowersort()
+{
+    const int INT_EXAMPLE = 2;
+    vector<int> lens(LENS, LENS + N_DIFFERENT_LENS);
+
+    cout << "Testing Powersort merge order:\n";
+    testGenerator(INT_EXAMPLE, lens, createRandomIntArray, std::less<int>(), POWERSORT_PARAMS);
+    testGenerator(INT_EXAMPLE, lens, createPartiallySorted, std::less<int>(), POWERSORT_PARAMS);
+
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<KeyIndex> arr_tim;
+        createFewUniqueKeyIndexArray(arr_tim, LENS[len_i]);
+        vector<KeyIndex> arr_std(arr_tim.begin(), arr_tim.end());
+
+        timSort(arr_tim.begin(), arr_tim.end(), CompareKeyFunctor(), POWERSORT_PARAMS);
+        std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+        cout << "    Stability for len " << LENS[len_i] << ":";
+        if (isEqualArrays(arr_tim, arr_std))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+//Element i equals i, so galloping can be checked on lengths beyond 2^31 without memory
+class IndexValues
+{
+public:
+    std::ptrdiff_t operator [](std::ptrdiff_t i) const
+    {
+        return i;
+    }
+};
+
+void testLargeSizes()
+{
+    const std::ptrdiff_t LARGE_LEN = 3000000000LL;
+    const std::ptrdiff_t KEYS[] = {0, 1, 2147483647LL, 2147483648LL, 2999999999LL, 3000000000LL};
+
+    cout << "Testing sizes beyond 2^31:\n";
+    bool succeeded = DEFAULT_PARAMS.minRun(LARGE_LEN) >= MAX_MIN_RUN_LENGTH / 2 &&
+                     DEFAULT_PARAMS.minRun(LARGE_LEN) <= MAX_MIN_RUN_LENGTH &&
+                     DEFAULT_PARAMS.whatMerge(LARGE_LEN, LARGE_LEN, LARGE_LEN) == WM_MERGE_YZ;
+
+    for (size_t i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); i++)
+    {
+        const std::ptrdiff_t* key = KEYS + i;
+        succeeded = succeeded &&
+                    gallopLeft(key, IndexValues(), LARGE_LEN, 0, std::less<std::ptrdiff_t>()) == KEYS[i] &&
+                    gallopLeft(key, IndexValues(), LARGE_LEN, LARGE_LEN - 1, std::less<std::ptrdiff_t>()) == KEYS[i] &&
+                    gallopRight(key, IndexValues(), LARGE_LEN, 0, std::less<std::ptrdiff_t>()) == std::min(KEYS[i] + 1, LARGE_LEN) &&
+                    gallopRight(key, IndexValues(), LARGE_LEN, LARGE_LEN / 2, std::less<std::ptrdiff_t>()) == std::min(KEYS[i] + 1, LARGE_LEN);
+    }
+
+    if (succeeded)
+        cout << "    Test succeeded\n";
+    else
+        cout << "    Sorry, test failed\n";
+}
+
+void testStats()
+{
+    cout << "Testing stats:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<Point3D> points;
+        createRandomPointsArray(points, LENS[len_i]);
+        vector<int> sorted_arr(LENS[len_i]);
+        for (int i = 0; i < LENS[len_i]; i++)
+            sorted_arr[i] = i;
+
+        TimSortStats stats, sorted_stats;
+        timSort(points.begin(), points.end(), ComparePointFunctor(), DEFAULT_PARAMS, stats);
+        timSort<PowersortPolicy>(sorted_arr.begin(), sorted_arr.end(), std::less<int>(), sorted_stats);
+
+        //Every merge joins two runs into one
+        bool succeeded = std::is_sorted(points.begin(), points.end(), ComparePointFunctor()) &&
+                         (LENS[len_i] < 2 || stats.n_merges == stats.n_runs - 1) &&
+                         stats.n_comparisons >= LENS[len_i] - 1 &&
+                         stats.n_merges_xy + stats.n_merges_yz <= stats.n_merges &&
+                         stats.n_gallop_successes <= 2 * stats.n_comparisons &&
+                         (stats.n_merges == 0 || stats.n_moves > 0) &&
+                         sorted_stats.n_merges == 0 && sorted_stats.n_moves == 0 &&
+                         sorted_stats.n_comparisons == std::max(LENS[len_i] - 1, 0);
+
+        cout << "    For len " << LENS[len_i] << ": runs " << stats.n_runs << ", comparisons " << stats.n_comparisons
+             << ", moves " << stats.n_moves << ", gallops " << stats.n_gallop_successes << "/" << stats.n_gallop_entries
+             << ", max stack " << stats.max_stack_depth << ", merge time " << stats.phase_seconds[TP_MERGING] << ":";
+        if (succeeded)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testSortedBuffer()
+{
+    const int MAX_BATCH = 300;
+
+    cout << "Testing sorted buffer:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<KeyIndex> appended;
+        createFewUniqueKeyIndexArray(appended, LENS[len_i]);
+
+        TimSortedBuffer<KeyIndex, CompareKeyFunctor> buffer;
+        bool succeeded = true;
+        size_t n_appended = 0;
+        while (n_appended < appended.size())
+        {
+            size_t batch = std::min(appended.size() - n_appended, static_cast<size_t>(rand() % MAX_BATCH));
+            if (batch <= 1)
+                buffer.append(appended[n_appended++]);
+            else
+            {
+                buffer.append(appended.begin() + n_appended, appended.begin() + n_appended + batch);
+                n_appended += batch;
+            }
+
+            //Runs grow geometrically, so there are few of them
+            succeeded = succeeded && buffer.getRunsNumber() <= 64;
+        }
+
+        //A copy keeps the unmerged runs and merges them with its own state
+        TimSortedBuffer<KeyIndex, CompareKeyFunctor> copy(buffer);
+
+        KeyIndex key = {5, 0};
+        vector<KeyIndex> arr_std(appended.begin(), appended.end());
+        std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+        vector<KeyIndex> arr_buffer(buffer.begin(), buffer.end()), arr_copy(copy.begin(), copy.end());
+        succeeded = succeeded && isEqualArrays(arr_buffer, arr_std) && isEqualArrays(arr_copy, arr_std) &&
+                    buffer.getRunsNumber() <= 1 &&
+                    buffer.upperBound(key) - buffer.lowerBound(key) ==
+                    std::upper_bound(arr_std.begin(), arr_std.end(), key, CompareKeyFunctor()) -
+                    std::lower_bound(arr_std.begin(), arr_std.end(), key, CompareKeyFunctor());
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (succeeded)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testExternalSort()
+{
+    const char* INPUT_PATH = "timsort_external_input.bin";
+    const char* OUTPUT_PATH = "timsort_external_output.bin";
+    //Few records per chunk and per buffer, so there are many runs and several merge passes
+    const DefaultExternalSortParams PARAMS(64 * sizeof(KeyIndex), 8 * sizeof(KeyIndex), ".");
+
+    cout << "Testing external sort:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<KeyIndex> arr_std;
+        if (len_i % 2 == 0)
+            createFewUniqueKeyIndexArray(arr_std, LENS[len_i]);
+        else
+        {
+            //Sorted chunks continue each other, so they are joined into few runs
+            createFewUniqueKeyIndexArray(arr_std, LENS[len_i]);
+            std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+        }
+
+        FILE* input = fopen(INPUT_PATH, "wb");
+        fwrite(arr_std.data(), sizeof(KeyIndex), arr_std.size(), input);
+        fclose(input);
+
+        externalTimSort<KeyIndex>(INPUT_PATH, OUTPUT_PATH, PARAMS, CompareKeyFunctor());
+        std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+        vector<KeyIndex> arr_ext(arr_std.size());
+        FILE* output = fopen(OUTPUT_PATH, "rb");
+        size_t n_read = fread(arr_ext.data(), sizeof(KeyIndex), arr_ext.size() + 1, output);
+        fclose(output);
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (n_read == arr_std.size() && isEqualArrays(arr_ext, arr_std))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+
+    remove(INPUT_PATH);
+    remove(OUTPUT_PATH);
+}
+
+class KeyIndexKey
+{
+public:
+    int operator ()(const KeyIndex& a) const
+    {
+        return a.key;
+    }
+};
+
+class ComparePointGreater
+{
+public:
+    bool operator ()(const Point3D& p1, const Point3D& p2) const
+    {
+        return (p1.x > p2.x);
+    }
+};
+
+int getPointX(const Point3D& p)
+{
+    return p.x;
+}
+
+void testSortByKey()
+{
+    cout << "Testing sort by key:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<KeyIndex> arr_key;
+        createFewUniqueKeyIndexArray(arr_key, LENS[len_i]);
+        vector<KeyIndex> arr_std(arr_key);
+        timSortByKey(arr_key.begin(), arr_key.end(), KeyIndexKey());
+        std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+        vector<Point3D> points(LENS[len_i]);
+        vector<Point3D> points_std(points);
+        timSortByKey(points.begin(), points.end(), getPointX, std::greater<int>());
+        std::stable_sort(points_std.begin(), points_std.end(), ComparePointGreater());
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (isEqualArrays(arr_key, arr_std) && isEqualArrays(points, points_std))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testArgSort()
+{
+    cout << "Testing argsort:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<KeyIndex> arr;
+        createFewUniqueKeyIndexArray(arr, LENS[len_i]);
+        vector<KeyIndex> arr_std(arr);
+        std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+        //Narrow indices, wide indices sorted as narrow ones, and the permutation applied to two arrays
+        std::vector<unsigned short> short_permutation;
+        bool narrow_rejected = false;
+        try
+        {
+            timArgSort(arr.begin(), arr.end(), short_permutation, CompareKeyFunctor());
+        }
+        catch (const std::length_error&)
+        {
+            narrow_rejected = true;
+        }
+        std::vector<std::ptrdiff_t> permutation;
+        timArgSort(arr.begin(), arr.end(), permutation, CompareKeyFunctor());
+
+        vector<KeyIndex> arr_permuted(arr);
+        vector<int> keys(arr.size());
+        for (size_t i = 0; i < arr.size(); i++)
+            keys[i] = arr[i].key;
+        applyPermutation(arr_permuted.begin(), permutation);
+        applyPermutation(keys.begin(), permutation);
+
+        bool succeeded = isEqualArrays(arr_permuted, arr_std) && narrow_rejected == (arr.size() > 65536);
+        for (size_t i = 0; i < arr.size(); i++)
+            succeeded = succeeded && keys[i] == arr_std[i].key &&
+                        (narrow_rejected || short_permutation[i] == permutation[i]);
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (succeeded)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+//Strings sharing long prefixes, with zero bytes and bytes above 127
+void createPrefixedStringArray(vector<string>& arr, int len)
+{
+    const char ALPHABET[] = {'a', 'b', '\0', '\xff'};
+    const int MAX_SUFFIX_LEN = 12;
+    const string PREFIXES[] = {"", "http://", "http://example.com/", "http://example.com/a"};
+
+    arr = vector<string>(len);
+    for (int i = 0; i < len; i++)
+    {
+        arr[i] = PREFIXES[rand() % 4];
+        int suffix_len = rand() % MAX_SUFFIX_LEN;
+        for (int j = 0; j < suffix_len; j++)
+            arr[i] += ALPHABET[rand() % 4];
+    }
+}
+
+void testStringSort()
+{
+    cout << "Testing string sort:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<string> arr_tim;
+        if (len_i % 2 == 0)
+            createPrefixedStringArray(arr_tim, LENS[len_i]);
+        else
+            createRandomStringArray(arr_tim, LENS[len_i] / 10);
+        vector<string> arr_std(arr_tim);
+
+        timSortStrings(arr_tim.begin(), arr_tim.end());
+        std::sort(arr_std.begin(), arr_std.end());
+
+        cout << "    For len " << arr_tim.size() << ":";
+        if (isEqualArrays(arr_tim, arr_std))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+//Few distinct values with both zeros, so stability shows in the bits
+template <class Type>
+void createSignedZeroArray(vector<Type>& arr, int len)
+{
+    const Type VALUES[] = {Type(-0.0), Type(0.0), Type(-1.5), Type(2.5), Type(-1000000), Type(1000000)};
+
+    arr = vector<Type>(len);
+    for (int i = 0; i < len; i++)
+        arr[i] = VALUES[rand() % 6];
+}
+
+//hybridTimSort must give exactly what timSort gives, on run-free and on structured inputs
+template <class Type, class Generator, class Compare>
+void testHybridType(const char* type_name, Generator gen, Compare comp)
+{
+    cout << "    " << type_name << ":\n";
+    std::vector<Type> buffer;
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<Type> arr_hybrid;
+        gen(arr_hybrid, LENS[len_i]);
+        if (len_i % 2 == 1)
+            std::sort(arr_hybrid.begin(), arr_hybrid.begin() + arr_hybrid.size() / 2, comp);
+        vector<Type> arr_tim(arr_hybrid);
+
+        hybridTimSort(arr_hybrid.begin(), arr_hybrid.end(), comp, buffer);
+        timSort(arr_tim.begin(), arr_tim.end(), comp);
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (memcmp(arr_hybrid.data(), arr_tim.data(), arr_tim.size() * sizeof(Type)) == 0)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testHybridSort()
+{
+    cout << "Testing hybrid sort:\n";
+    testHybridType<int>("int", createRandomIntArray, std::less<int>());
+    testHybridType<int>("int descending", createRandomIntArray, std::greater<int>());
+    testHybridType<long long>("int64", createRandomArithmeticArray<long long>, std::less<long long>());
+    testHybridType<unsigned short>("uint16", createRandomArithmeticArray<unsigned short>, std::less<unsigned short>());
+    testHybridType<double>("double", createSignedZeroArray<double>, std::less<double>());
+    testHybridType<float>("float descending", createSignedZeroArray<float>, std::greater<float>());
+
+    //radixSort resizes the buffer and timSort leaves it alone, so it shows which one sorted
+    const int ROUTING_LEN = 100000;
+    vector<int> arr_random, arr_sorted, random_buffer, sorted_buffer;
+    createRandomIntArray(arr_random, ROUTING_LEN);
+    createRandomIntArray(arr_sorted, ROUTING_LEN);
+    std::sort(arr_sorted.begin(), arr_sorted.end());
+    hybridTimSort(arr_random.begin(), arr_random.end(), std::less<int>(), random_buffer);
+    hybridTimSort(arr_sorted.begin(), arr_sorted.end(), std::less<int>(), sorted_buffer);
+
+    cout << "    Random ints go to radixSort, sorted ones to timSort:";
+    if (random_buffer.size() == static_cast<size_t>(ROUTING_LEN) && sorted_buffer.empty() &&
+        std::is_sorted(arr_random.begin(), arr_random.end()))
+        cout << "    Test succeeded\n";
+    else
+        cout << "    Sorry, test failed\n";
+}
+
+void testBatchSort()
+{
+    const int MAX_SEGMENT_LEN = 500;
+    const int N_THREADS = 3;
+    TimSortThreadPool pool(N_THREADS);
+
+    cout << "Testing batch sort:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        vector<KeyIndex> arr;
+        createFewUniqueKeyIndexArray(arr, LENS[len_i]);
+        vector<std::ptrdiff_t> offsets(1, 0);
+        while (offsets.back() < static_cast<std::ptrdiff_t>(arr.size()))
+            offsets.push_back(std::min<std::ptrdiff_t>(arr.size(), offsets.back() + rand() % MAX_SEGMENT_LEN));
+
+        vector<KeyIndex> arr_std(arr);
+        for (size_t i = 0; i + 1 < offsets.size(); i++)
+            std::stable_sort(arr_std.begin() + offsets[i], arr_std.begin() + offsets[i + 1], CompareKeyFunctor());
+
+        //Custom params give every segment exactly what timSort with them gives, also the unstable in-place order
+        const ShortRunParams SHORT_RUNS;
+        vector<KeyIndex> arr_short(arr), arr_short_tim(arr);
+        timSortSegments(arr_short.begin(), offsets, CompareKeyFunctor(), SHORT_RUNS);
+        for (size_t i = 0; i + 1 < offsets.size(); i++)
+            timSort(arr_short_tim.begin() + offsets[i], arr_short_tim.begin() + offsets[i + 1], CompareKeyFunctor(), SHORT_RUNS);
+
+        //Flat with offsets, in parallel, and as a list of ranges
+        vector<KeyIndex> arr_flat(arr), arr_parallel(arr), arr_ranges(arr);
+        timSortSegments(arr_flat.begin(), offsets, CompareKeyFunctor());
+        timSortSegments(arr_parallel.begin(), offsets, CompareKeyFunctor(), pool);
+        vector<std::pair<vector<KeyIndex>::iterator, vector<KeyIndex>::iterator>> ranges;
+        for (size_t i = 0; i + 1 < offsets.size(); i++)
+            ranges.push_back(std::make_pair(arr_ranges.begin() + offsets[i], arr_ranges.begin() + offsets[i + 1]));
+        timSortSegments(ranges, CompareKeyFunctor(), POWERSORT_PARAMS);
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (isEqualArrays(arr_flat, arr_std) && isEqualArrays(arr_parallel, arr_std) && isEqualArrays(arr_ranges, arr_std) &&
+            isEqualArrays(arr_short, arr_short_tim))
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+void testKWayMerge()
+{
+    const int N_SOURCES[] = {1, 2, 5, 64, 1000};
+    const int MAX_BLOCK = 50;
+
+    cout << "Testing k-way merge:\n";
+    for (size_t k_i = 0; k_i < sizeof(N_SOURCES) / sizeof(N_SOURCES[0]); k_i++)
+    {
+        for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+        {
+            //Sorted shards, every second test takes keys from sources in long blocks
+            vector<KeyIndex> arr;
+            createFewUniqueKeyIndexArray(arr, LENS[len_i]);
+            if (len_i % 2 == 1)
+                std::stable_sort(arr.begin(), arr.end(), CompareKeyFunctor());
+            vector<vector<KeyIndex>> shards(N_SOURCES[k_i]);
+            for (size_t i = 0; i < arr.size(); i += MAX_BLOCK)
+            {
+                vector<KeyIndex>& shard = shards[rand() % N_SOURCES[k_i]];
+                shard.insert(shard.end(), arr.begin() + i, arr.begin() + std::min(arr.size(), i + MAX_BLOCK));
+            }
+
+            vector<std::pair<vector<KeyIndex>::iterator, vector<KeyIndex>::iterator>> sources;
+            vector<KeyIndex> arr_std, arr_inplace;
+            vector<std::ptrdiff_t> offsets(1, 0);
+            for (size_t i = 0; i < shards.size(); i++)
+            {
+                std::stable_sort(shards[i].begin(), shards[i].end(), CompareKeyFunctor());
+                arr_std.insert(arr_std.end(), shards[i].begin(), shards[i].end());
+                sources.push_back(std::make_pair(shards[i].begin(), shards[i].end()));
+                offsets.push_back(arr_std.size());
+            }
+            arr_inplace = arr_std;
+            std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+            //Integer keys are merged by the merge engine instead of the loser tree
+            vector<vector<int>> key_shards(shards.size());
+            vector<std::pair<vector<int>::iterator, vector<int>::iterator>> key_sources;
+            for (size_t i = 0; i < shards.size(); i++)
+            {
+                for (size_t j = 0; j < shards[i].size(); j++)
+                    key_shards[i].push_back(shards[i][j].key);
+                key_sources.push_back(std::make_pair(key_shards[i].begin(), key_shards[i].end()));
+            }
+            vector<int> keys_merged(arr_std.size());
+            kWayMerge(key_sources, keys_merged.begin(), std::less<int>());
+
+            vector<KeyIndex> arr_merged(arr_std.size());
+            bool succeeded = kWayMerge(sources, arr_merged.begin(), CompareKeyFunctor()) == arr_merged.end();
+            for (size_t i = 0; i < arr_std.size(); i++)
+                succeeded = succeeded && keys_merged[i] == arr_std[i].key;
+            kWayMergeInplace(arr_inplace.begin(), offsets, CompareKeyFunctor(), k_i % 2 ? POWERSORT_PARAMS : DEFAULT_PARAMS);
+
+            cout << "    For " << N_SOURCES[k_i] << " sources, len " << LENS[len_i] << ":";
+            if (succeeded && isEqualArrays(arr_merged, arr_std) && isEqualArrays(arr_inplace, arr_std))
+                cout << "    Test succeeded\n";
+            else
+                cout << "    Sorry, test failed\n";
+        }
+    }
+}
+
+void testSorter()
+{
+    const MergeBudgetParams SMALL_BUDGET(256 * sizeof(KeyIndex));
+    const MergeBudgetParams NO_BUFFER(NO_MERGE_BUFFER);
+    //One sorter of each kind is used for all lengths, the first and the last ones have their memory reserved
+    TimSorter<KeyIndex, CompareKeyFunctor> sorter;
+    sorter.reserve(LENS[N_DIFFERENT_LENS - 1]);
+    TimSorter<KeyIndex, CompareKeyFunctor> powersort_sorter(CompareKeyFunctor(), POWERSORT_PARAMS);
+    TimSorter<KeyIndex, CompareKeyFunctor> budget_sorter(CompareKeyFunctor(), SMALL_BUDGET);
+    TimSorter<KeyIndex, CompareKeyFunctor> no_buffer_sorter(CompareKeyFunctor(), NO_BUFFER);
+    no_buffer_sorter.reserve(LENS[N_DIFFERENT_LENS - 1]);
+
+    cout << "Testing sorter:\n";
+    for (int len_i = N_DIFFERENT_LENS - 1; len_i >= 0; len_i--)
+    {
+        vector<KeyIndex> arr;
+        createFewUniqueKeyIndexArray(arr, LENS[len_i]);
+        vector<KeyIndex> arr_std(arr), arr_powersort(arr), arr_budget(arr), arr_no_buffer(arr);
+        std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+
+        //Reserved sorters keep their merge buffer and run stack, so they do not allocate
+        const KeyIndex* buffer = sorter.getMergeBuffer();
+        std::ptrdiff_t buffer_size = sorter.getMergeBufferSize();
+        size_t stack_capacity = sorter.getStackCapacity(), no_buffer_stack_capacity = no_buffer_sorter.getStackCapacity();
+        sorter.sort(arr.begin(), arr.end());
+        no_buffer_sorter.sort(arr_no_buffer.begin(), arr_no_buffer.end());
+        bool allocated = sorter.getMergeBuffer() != buffer || sorter.getMergeBufferSize() != buffer_size ||
+                         sorter.getStackCapacity() != stack_capacity || no_buffer_sorter.getMergeBufferSize() != 0 ||
+                         no_buffer_sorter.getStackCapacity() != no_buffer_stack_capacity;
+        powersort_sorter.sort(arr_powersort.begin(), arr_powersort.end());
+        budget_sorter.sort(arr_budget.begin(), arr_budget.end());
+
+        //In-place merges are not stable, only the keys are compared
+        bool no_buffer_sorted = true;
+        for (size_t i = 0; i < arr_std.size(); i++)
+            no_buffer_sorted = no_buffer_sorted && arr_no_buffer[i].key == arr_std[i].key;
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (isEqualArrays(arr, arr_std) && isEqualArrays(arr_powersort, arr_std) && isEqualArrays(arr_budget, arr_std) &&
+            no_buffer_sorted && !allocated)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+bool compareKeyIndexFull(const KeyIndex& a, const KeyIndex& b)
+{
+    return (a.key < b.key || (a.key == b.key && a.index < b.index));
+}
+
+void testPartialSort()
+{
+    const int N_KS = 5;
+    const int KS[N_KS] = {1, 7, 100, 5000, 200000};
+    const MergeBudgetParams NO_BUFFER(NO_MERGE_BUFFER);
+
+    cout << "Testing partial sort:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        bool succeeded = true;
+        for (int k_i = 0; k_i < N_KS; k_i++)
+        {
+            //Random, nearly sorted and reversed inputs
+            vector<KeyIndex> arr;
+            createFewUniqueKeyIndexArray(arr, LENS[len_i]);
+            if (k_i % 3 == 1)
+            {
+                std::stable_sort(arr.begin(), arr.end(), CompareKeyFunctor());
+                if (!arr.empty())
+                    std::swap(arr[rand() % arr.size()], arr[rand() % arr.size()]);
+            }
+            else if (k_i % 3 == 2)
+                std::reverse(arr.begin(), arr.end());
+
+            size_t k = std::min<size_t>(KS[k_i], arr.size());
+            vector<KeyIndex> arr_std(arr), arr_no_buffer(arr);
+            std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+            timPartialSort(arr.begin(), arr.begin() + k, arr.end(), CompareKeyFunctor());
+            timPartialSort(arr_no_buffer.begin(), arr_no_buffer.begin() + k, arr_no_buffer.end(),
+                           CompareKeyFunctor(), NO_BUFFER);
+
+            //The rest holds exactly the other elements
+            std::sort(arr.begin() + k, arr.end(), compareKeyIndexFull);
+            std::sort(arr_no_buffer.begin() + k, arr_no_buffer.end(), compareKeyIndexFull);
+            std::sort(arr_std.begin() + k, arr_std.end(), compareKeyIndexFull);
+            succeeded = succeeded && isEqualArrays(arr, arr_std) && isEqualArrays(arr_no_buffer, arr_std);
+        }
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (succeeded)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
+
+//Blocks of equal keys, ascending with a descent every few blocks
+void createEqualBlocksArray(vector<KeyIndex>& arr, int len, int n_keys)
+{
+    arr = vector<KeyIndex>(len);
+    int key = rand() % n_keys;
+    for (int i = 0; i < len; i++)
+    {
+        if (rand() % 8 == 0)
+            key = (rand() % 4 == 0) ? rand() % n_keys : std::min(key + 1, n_keys - 1);
+        arr[i].key = key;
+        arr[i].index = i;
+    }
+}
+
+void testFewKeys()
+{
+    const int N_KEY_NUMBERS = 6;
+    const int KEY_NUMBERS[N_KEY_NUMBERS] = {1, 2, 50, 64, 65, 1000};
+
+    cout << "Testing few keys sort:\n";
+    for (int len_i = 0; len_i < N_DIFFERENT_LENS; len_i++)
+    {
+        bool succeeded = true;
+        for (int keys_i = 0; keys_i < N_KEY_NUMBERS; keys_i++)
+        {
+            vector<KeyIndex> arr(LENS[len_i]);
+            for (int i = 0; i < LENS[len_i]; i++)
+            {
+                arr[i].key = rand() % KEY_NUMBERS[keys_i];
+                arr[i].index = i;
+            }
+            vector<KeyIndex> arr_std(arr);
+            std::stable_sort(arr_std.begin(), arr_std.end(), CompareKeyFunctor());
+            timSortFewKeys(arr.begin(), arr.end(), CompareKeyFunctor());
+            succeeded = succeeded && isEqualArrays(arr, arr_std);
+
+            //Equal neighbours continue ascending runs, both in the scalar and in the vector scan
+            vector<KeyIndex> blocks;
+            createEqualBlocksArray(blocks, LENS[len_i], KEY_NUMBERS[keys_i]);
+            vector<KeyIndex> blocks_std(blocks);
+            vector<int> keys, keys_std;
+            for (size_t i = 0; i < blocks.size(); i++)
+                keys.push_back(blocks[i].key);
+            keys_std = keys;
+            std::stable_sort(blocks_std.begin(), blocks_std.end(), CompareKeyFunctor());
+            std::sort(keys_std.begin(), keys_std.end());
+            timSort(blocks.begin(), blocks.end(), CompareKeyFunctor());
+            timSort(keys.begin(), keys.end());
+            succeeded = succeeded && isEqualArrays(blocks, blocks_std) && isEqualArrays(keys, keys_std);
+
+            std::reverse(keys.begin(), keys.end());
+            timSort(keys.begin(), keys.end(), std::greater<int>());
+            std::reverse(keys_std.begin(), keys_std.end());
+            succeeded = succeeded && isEqualArrays(keys, keys_std);
+        }
+
+        cout << "    For len " << LENS[len_i] << ":";
+        if (succeeded)
+            cout << "    Test succeeded\n";
+        else
+            cout << "    Sorry, test failed\n";
+    }
+}
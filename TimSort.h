@@ -2,96 +2,58 @@
 #include "Run.h"
 #include "TimSortParams.h"
 #include "InplaceMerge.h"
+#include "BufferedMerge.h"
+#include "Powersort.h"
+#include "TimSortStats.h"
 
 #define PURE =0
 
 using std::stack;
 
-template <class RandomAccessIterator>
-void reverseArrayPart(RandomAccessIterator start, RandomAccessIterator finish)
-{
-    finish--;
-
-    while (start < finish)
-    {
-        timSortSwap(*start, *finish);
-        start++;
-        finish--;
-    }
-}
-
-template <class RandomAccessIterator>
-void insert(RandomAccessIterator dest, RandomAccessIterator src)
+template <class Stack, class Run>
+void popTo(Stack& runs, Run& x)
 {
-    timSortSwap(*dest, *src);
-    RandomAccessIterator right = src;
-    while (right > dest + 1)
-    {
-        timSortSwap(*(right - 1), *right);
-        right--;
-    }
+    x = runs.top();
+    runs.pop();
 }
 
-template <class RandomAccessIterator, class Compare>
-void insertionSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+//Run stack over a vector whose memory can be reserved in advance
+template <class Run>
+class RunStack : public stack<Run, std::vector<Run>>
 {
-    int sorted_part_size = 1;
-    RandomAccessIterator curr = start + 1;
-    while (curr != finish && comp(*(curr - 1), *curr))
+public:
+    void reserve(size_t n_runs)
     {
-        curr++;
-        sorted_part_size++;
+        this->c.reserve(n_runs);
     }
 
-    while (curr != finish)
+    size_t capacity() const
     {
-        RandomAccessIterator to_insert = start;
-        while (comp(*to_insert, *curr))
-            to_insert++;
-        insert(to_insert, curr);
-        curr++;
+        return this->c.capacity();
     }
-}
+};
 
-template <class RandomAccessIterator>
-void insertionSort(RandomAccessIterator start, RandomAccessIterator finish)
+//Runs are pushed left to right as they are found and merged as whatMerge and needMerge of params say,
+//mergeAll finishes the sort
+template <class RandomAccessIterator, class Compare, class Params, class Stats>
+class RunStackMerger
 {
-    insertionSort(start, finish, std::less<std::iterator_traits<RandomAccessIterator>::value_type>());
-}
+public:
+    RunStackMerger(Compare comp, const Params& params, MergeState<RandomAccessIterator, Stats>& state):
+        comp (comp),
+        params (params),
+        state (state)
 
-template <class Run>
-void popTo(stack<Run>& runs, Run& x)
-{
-    x = runs.top();
-    runs.pop();
-}
+        {}
 
-template <class Run, class Compare>
-void replaceWithMerged(stack<Run>& runs, Run& left, Run& right, Compare comp, int gallop)
-{
-    inplaceMerge(left, right, comp, gallop);
-    left.size += right.size;
-    runs.push(left);
-}
-
-template <class RandomAccessIterator, class Compare>
-void timSort(RandomAccessIterator start, RandomAccessIterator finish,
-             Compare comp, const ITimSortParams& params = DEFAULT_PARAMS)
-{
-    vector<Run<RandomAccessIterator>> runs;
-    divideArrayToRuns(start, finish, runs, comp, params);
-    if (runs.size() < 2)
-        return;
-
-    //cout << "NRuns: " << runs.size() << "\n";
-
-    stack<Run<RandomAccessIterator>> run_stack;
-    run_stack.push(runs[0]);
-    for (size_t i = 1; i < runs.size(); i++)
+    void pushRun(Run<RandomAccessIterator> run)
     {
-        run_stack.push(runs[i]);
-        Run<RandomAccessIterator> x, y, z;
+        run_stack.push(run);
+        state.getStats().updateStackDepth(run_stack.size());
+        if (run_stack.size() < 2)
+            return;
 
+        Run<RandomAccessIterator> x, y, z;
         popTo(run_stack, x);
         popTo(run_stack, y);
 
@@ -99,20 +61,23 @@ void timSort(RandomAccessIterator start, RandomAccessIterator finish,
         {
             popTo(run_stack, z); 
             EWhatMerge merge_type = params.whatMerge(x.size, y.size, z.size);
+            state.getStats().countMergeDecision(merge_type);
             
             switch (merge_type)
             {
                 case WM_MERGE_XY:
-                    inplaceMerge(y, x, comp, params.getGallop());
+                    mergeRuns(y, x, comp, state);
                     y.size += x.size;
                     x = y;
                     y = z;
                     break;
                 case WM_MERGE_YZ:
-                    inplaceMerge(z, y, comp, params.getGallop());
+                    mergeRuns(z, y, comp, state);
                     z.size += y.size;
                     y = z;
                     break;
+                case WM_NO_MERGE:
+                    break;
             }
 
             if (merge_type == WM_NO_MERGE)
@@ -123,7 +88,7 @@ void timSort(RandomAccessIterator start, RandomAccessIterator finish,
         }
 
         if (params.needMerge(x.size, y.size))
-            replaceWithMerged(run_stack, y, x, comp, params.getGallop());
+            replaceWithMerged(y, x);
         else
         {
             run_stack.push(y);
@@ -131,13 +96,123 @@ void timSort(RandomAccessIterator start, RandomAccessIterator finish,
         }
     }
 
-    while (run_stack.size() > 1)
+    void reserveStack(size_t n_runs)
     {
-        Run<RandomAccessIterator> x, y;
-        popTo(run_stack, x);
-        popTo(run_stack, y);
-        replaceWithMerged(run_stack, y, x, comp, params.getGallop());
+        run_stack.reserve(n_runs);
+    }
+
+    size_t getStackCapacity() const
+    {
+        return run_stack.capacity();
     }
+
+    //Leaves the run stack empty, so the merger may be used for the next sort
+    void mergeAll()
+    {
+        while (run_stack.size() > 1)
+        {
+            Run<RandomAccessIterator> x, y;
+            popTo(run_stack, x);
+            popTo(run_stack, y);
+            replaceWithMerged(y, x);
+        }
+        if (!run_stack.empty())
+            run_stack.pop();
+    }
+
+private:
+    void replaceWithMerged(Run<RandomAccessIterator>& left, Run<RandomAccessIterator>& right)
+    {
+        mergeRuns(left, right, comp, state);
+        left.size += right.size;
+        run_stack.push(left);
+    }
+
+    Compare comp;
+    const Params& params;
+    MergeState<RandomAccessIterator, Stats>& state;
+    RunStack<Run<RandomAccessIterator>> run_stack;
+};
+
+//Every run is merged right after it is found, while it is still in cache
+template <class RandomAccessIterator, class Compare, class Merger, class Stats>
+void findAndMergeRuns(RandomAccessIterator start, RandomAccessIterator finish, Compare comp,
+                      std::ptrdiff_t min_run, Merger& merger, Stats& stats)
+{
+    RandomAccessIterator curr_start = start;
+    while (curr_start != finish)
+    {
+        Run<RandomAccessIterator> run = nextRun(curr_start, finish, comp, min_run, stats);
+        stats.startPhase(TP_MERGING);
+        merger.pushRun(run);
+        stats.finishPhase(TP_MERGING);
+        curr_start += run.size;
+    }
+
+    stats.startPhase(TP_MERGING);
+    merger.mergeAll();
+    stats.finishPhase(TP_MERGING);
+}
+
+//Sorts with the merge state and the run stack merger of the caller, whose memory is kept between sorts
+template <class RandomAccessIterator, class Compare, class Params, class Stats>
+void timSortReusing(RandomAccessIterator start, RandomAccessIterator finish, Compare comp, const Params& params,
+                    MergeState<RandomAccessIterator, Stats>& merge_state,
+                    RunStackMerger<RandomAccessIterator, Compare, Params, Stats>& merger, Stats& stats)
+{
+    if (finish - start < 2)
+        return;
+
+    //Sorted and strictly reversed inputs are finished by one scan
+    stats.startPhase(TP_RUN_DETECTION);
+    RandomAccessIterator first_run_finish = findAscendingRunEnd(start, finish, comp);
+    bool is_reversed = first_run_finish == start + 1 && first_run_finish != finish &&
+                       findDescendingRunEnd(start, finish, comp) == finish;
+    if (is_reversed)
+        reverseArrayPart(start, finish);
+    stats.finishPhase(TP_RUN_DETECTION);
+
+    if (first_run_finish == finish || is_reversed)
+    {
+        stats.countRun();
+        return;
+    }
+
+    std::ptrdiff_t min_run = params.minRun(finish - start);
+    merge_state.restart(finish - start);
+    if (params.getMergeStrategy() == MS_POWERSORT)
+    {
+        PowersortMerger<RandomAccessIterator, Compare, Stats> powersort_merger(start, finish, comp, merge_state);
+        findAndMergeRuns(start, finish, comp, min_run, powersort_merger, stats);
+    }
+    else
+        findAndMergeRuns(start, finish, comp, min_run, merger, stats);
+}
+
+//Params is either ITimSortParams called through the vtable or a static policy like DefaultTimSortPolicy
+template <class RandomAccessIterator, class Compare, class Params, class Stats>
+void timSortImpl(RandomAccessIterator start, RandomAccessIterator finish,
+                 Compare comp, const Params& params, Stats& stats)
+{
+    MergeState<RandomAccessIterator, Stats> merge_state(params.getMergeBufferBudget(), finish - start,
+                                                        params.getGallop(), stats);
+    RunStackMerger<RandomAccessIterator, Compare, Params, Stats> merger(comp, params, merge_state);
+    timSortReusing(start, finish, comp, params, merge_state, merger, stats);
+}
+
+template <class RandomAccessIterator, class Compare, class Params>
+void timSortImpl(RandomAccessIterator start, RandomAccessIterator finish,
+                 Compare comp, const Params& params)
+{
+    NoTimSortStats stats;
+    timSortImpl(start, finish, comp, params, stats);
+}
+
+template <class RandomAccessIterator, class Compare>
+void timSort(RandomAccessIterator start, RandomAccessIterator finish,
+             Compare comp, const ITimSortParams& params = DEFAULT_PARAMS)
+{
+    timSortImpl(start, finish, comp, params);
 }
 
 template <class RandomAccessIterator>
@@ -146,4 +221,32 @@ void timSort(RandomAccessIterator start, RandomAccessIterator finish,
 {
     timSort(start, finish, 
             std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>(), params);
-}
\ No newline at end of file
+}
+
+//Sorts as timSort(start, finish, comp, params) does and adds what happened to stats
+template <class RandomAccessIterator, class Compare>
+void timSort(RandomAccessIterator start, RandomAccessIterator finish,
+             Compare comp, const ITimSortParams& params, TimSortStats& stats)
+{
+    timSortImpl(start, finish, CountingCompare<Compare, TimSortStats>(comp, stats), params, stats);
+}
+
+//Policy is a type with static members, so they can be inlined: timSort<DefaultTimSortPolicy>(start, finish, comp)
+template <class Policy, class RandomAccessIterator, class Compare>
+void timSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp)
+{
+    timSortImpl(start, finish, comp, Policy());
+}
+
+template <class Policy, class RandomAccessIterator>
+void timSort(RandomAccessIterator start, RandomAccessIterator finish)
+{
+    timSort<Policy>(start, finish,
+                    std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+template <class Policy, class RandomAccessIterator, class Compare>
+void timSort(RandomAccessIterator start, RandomAccessIterator finish, Compare comp, TimSortStats& stats)
+{
+    timSortImpl(start, finish, CountingCompare<Compare, TimSortStats>(comp, stats), Policy(), stats);
+}
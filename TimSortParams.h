@@ -1,11 +1,15 @@
 /*
 TimSortParams.h
-1. Offers class ITimSortParams with pure virtual funcions to set up your TimSort
-2. Offers a default ITimSortDefaultParams class
+1. Offers class ITimSortParams with pure virtual funcions to set up your TimSort,
+   the merge buffer budget and the merge strategy have defaults, so older subclasses still compile
+2. Offers a default ITimSortDefaultParams class and the same static DefaultTimSortPolicy
 3. Offers enumeration EWhatMerge to control merging processes in TimSort
+4. Offers memory budget constants for the auxiliary merge buffer
+5. Offers enumeration EMergeStrategy and Powersort params selecting the node-power merge order
 */
 
 #pragma once
+#include <cstddef>
 #define PURE =0
 
 enum EWhatMerge
@@ -15,24 +19,45 @@ enum EWhatMerge
     WM_NO_MERGE 
 };
 
+//MS_RUN_STACK merges as whatMerge and needMerge say, MS_POWERSORT ignores them
+enum EMergeStrategy
+{
+    MS_RUN_STACK,
+    MS_POWERSORT
+};
+
 const int MAX_MIN_RUN_LENGTH = 64;
 const int NO_GALLOPING_MODE = -1;
+const size_t NO_MERGE_BUFFER = 0;
+const size_t UNLIMITED_MERGE_BUFFER = static_cast<size_t>(-1);
 
 class ITimSortParams
 {
 public:
-    virtual int minRun(int n) const PURE;
-    virtual bool needMerge(int len_x, int len_y) const PURE; 
-    virtual EWhatMerge whatMerge(int len_x, int len_y, int len_z) const PURE;
+    virtual std::ptrdiff_t minRun(std::ptrdiff_t n) const PURE;
+    virtual bool needMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y) const PURE; 
+    virtual EWhatMerge whatMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y, std::ptrdiff_t len_z) const PURE;
     virtual int getGallop() const PURE;
+    //Bytes of auxiliary memory merges may use, NO_MERGE_BUFFER means fully in-place merging
+    virtual size_t getMergeBufferBudget() const
+    {
+        return UNLIMITED_MERGE_BUFFER;
+    }
+
+    virtual EMergeStrategy getMergeStrategy() const
+    {
+        return MS_RUN_STACK;
+    }
 };
 
-class IDefaultTimSortParams : public ITimSortParams
+//Static policy with the same members as ITimSortParams, for timSort<Policy>
+//Derive from it and hide the members you want to change
+class DefaultTimSortPolicy
 {
 public:
-    virtual int minRun(int n) const
+    static std::ptrdiff_t minRun(std::ptrdiff_t n)
     {
-        int flag = 0;
+        std::ptrdiff_t flag = 0;
         while (n >= MAX_MIN_RUN_LENGTH)
         {
             flag = flag | (n % 2);
@@ -41,12 +66,12 @@ public:
         return n + flag;
     }
 
-    virtual bool needMerge(int len_x, int len_y) const
+    static bool needMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y)
     {
         return (len_y <= len_x);
     }
 
-    virtual EWhatMerge whatMerge(int len_x, int len_y, int len_z) const
+    static EWhatMerge whatMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y, std::ptrdiff_t len_z)
     {
         if (len_z > len_x + len_y && len_y > len_x)
             return WM_NO_MERGE;
@@ -60,10 +85,73 @@ public:
         return WM_NO_MERGE;
     }
 
-    virtual int getGallop() const
+    static int getGallop()
     {
         return 7;
     }
+
+    static size_t getMergeBufferBudget()
+    {
+        return UNLIMITED_MERGE_BUFFER;
+    }
+
+    static constexpr EMergeStrategy getMergeStrategy()
+    {
+        return MS_RUN_STACK;
+    }
+};
+
+class PowersortPolicy : public DefaultTimSortPolicy
+{
+public:
+    static constexpr EMergeStrategy getMergeStrategy()
+    {
+        return MS_POWERSORT;
+    }
+};
+
+class IDefaultTimSortParams : public ITimSortParams
+{
+public:
+    virtual std::ptrdiff_t minRun(std::ptrdiff_t n) const
+    {
+        return DefaultTimSortPolicy::minRun(n);
+    }
+
+    virtual bool needMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y) const
+    {
+        return DefaultTimSortPolicy::needMerge(len_x, len_y);
+    }
+
+    virtual EWhatMerge whatMerge(std::ptrdiff_t len_x, std::ptrdiff_t len_y, std::ptrdiff_t len_z) const
+    {
+        return DefaultTimSortPolicy::whatMerge(len_x, len_y, len_z);
+    }
+
+    virtual int getGallop() const
+    {
+        return DefaultTimSortPolicy::getGallop();
+    }
+
+    virtual size_t getMergeBufferBudget() const
+    {
+        return DefaultTimSortPolicy::getMergeBufferBudget();
+    }
+
+    virtual EMergeStrategy getMergeStrategy() const
+    {
+        return DefaultTimSortPolicy::getMergeStrategy();
+    }
+};
+
+class IPowersortParams : public IDefaultTimSortParams
+{
+public:
+    virtual EMergeStrategy getMergeStrategy() const
+    {
+        return PowersortPolicy::getMergeStrategy();
+    }
 };
 
-const IDefaultTimSortParams DEFAULT_PARAMS;
\ No newline at end of file
+const IDefaultTimSortParams DEFAULT_PARAMS;
+const IPowersortParams POWERSORT_PARAMS;
\ No newline at end of file
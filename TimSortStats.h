@@ -0,0 +1,166 @@
+/*
+TimSortStats.h
+Optional instrumentation of TimSort
+1. Offers class TimSortStats: counters of runs, comparisons, moves, galloping and merges,
+   the maximal run stack depth and the time spent in every phase of the sort
+2. Offers class NoTimSortStats with empty members, used when no stats are passed,
+   so that instrumentation is compiled out
+3. Offers enumeration ETimSortPhase naming the timed phases
+*/
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include "TimSortParams.h"
+
+enum ETimSortPhase
+{
+    TP_RUN_DETECTION,
+    TP_SMALL_SORT,
+    TP_MERGING,
+    TP_PHASES_NUMBER
+};
+
+class NoTimSortStats
+{
+public:
+    static const bool ENABLED = false;
+
+    void countRun() {}
+    void countComparison() {}
+    void countMoves(std::ptrdiff_t) {}
+    void countGallopEntry() {}
+    void countGallopSuccess() {}
+    void countMerge() {}
+    void countMergeDecision(EWhatMerge) {}
+    void updateStackDepth(size_t) {}
+    void startPhase(ETimSortPhase) {}
+    void finishPhase(ETimSortPhase) {}
+};
+
+//Pass it to timSort to fill in; counters are added up over all sorts it was passed to.
+//Comparisons are counted by wrapping the comparator, so a sort with stats never takes the SIMD run scan,
+//the SIMD merge kernels or the sorting networks, which need std::less or std::greater: with arithmetic
+//elements its comparisons, moves and times are those of the generic path
+class TimSortStats
+{
+public:
+    static const bool ENABLED = true;
+
+    TimSortStats()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        n_runs = 0;
+        n_comparisons = 0;
+        n_moves = 0;
+        n_gallop_entries = 0;
+        n_gallop_successes = 0;
+        n_merges = 0;
+        n_merges_xy = 0;
+        n_merges_yz = 0;
+        max_stack_depth = 0;
+        for (int i = 0; i < TP_PHASES_NUMBER; i++)
+            phase_seconds[i] = 0;
+    }
+
+    void countRun()
+    {
+        n_runs++;
+    }
+
+    void countComparison()
+    {
+        n_comparisons++;
+    }
+
+    void countMoves(std::ptrdiff_t n_new_moves)
+    {
+        n_moves += n_new_moves;
+    }
+
+    void countGallopEntry()
+    {
+        n_gallop_entries++;
+    }
+
+    //A search which skipped at least gallop elements at once
+    void countGallopSuccess()
+    {
+        n_gallop_successes++;
+    }
+
+    void countMerge()
+    {
+        n_merges++;
+    }
+
+    void countMergeDecision(EWhatMerge decision)
+    {
+        if (decision == WM_MERGE_XY)
+            n_merges_xy++;
+        else if (decision == WM_MERGE_YZ)
+            n_merges_yz++;
+    }
+
+    void updateStackDepth(size_t depth)
+    {
+        if (depth > max_stack_depth)
+            max_stack_depth = depth;
+    }
+
+    void startPhase(ETimSortPhase)
+    {
+        phase_start = std::chrono::steady_clock::now();
+    }
+
+    void finishPhase(ETimSortPhase phase)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - phase_start;
+        phase_seconds[phase] += elapsed.count();
+    }
+
+    long long n_runs;
+    long long n_comparisons;
+    //Moves and swaps of elements done by merges with auxiliary memory and by rotations
+    long long n_moves;
+    long long n_gallop_entries;
+    long long n_gallop_successes;
+    //All merges, and merges chosen by whatMerge of ITimSortParams
+    long long n_merges;
+    long long n_merges_xy;
+    long long n_merges_yz;
+    size_t max_stack_depth;
+    double phase_seconds[TP_PHASES_NUMBER];
+
+private:
+    std::chrono::steady_clock::time_point phase_start;
+};
+
+//Comparator counting its calls in stats. It is a type of its own, so paths chosen by the comparator type,
+//SIMD scans and merges and sorting networks, are not taken under it
+template <class Compare, class Stats>
+class CountingCompare
+{
+public:
+    CountingCompare(Compare comp, Stats& stats):
+        comp (comp),
+        stats (&stats)
+
+        {}
+
+    template <class First, class Second>
+    bool operator ()(First&& first, Second&& second)
+    {
+        stats->countComparison();
+        return comp(std::forward<First>(first), std::forward<Second>(second));
+    }
+
+private:
+    Compare comp;
+    Stats* stats;
+};
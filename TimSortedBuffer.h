@@ -0,0 +1,256 @@
+/*
+TimSortedBuffer.h
+Container which keeps appended elements ordered lazily
+1. Offers template class TimSortedBuffer: every appended batch becomes a run on the run stack,
+   runs are merged as whatMerge and needMerge of the static Policy say
+2. Iteration and lookups merge the whole stack first, so each element takes part
+   in O(log n) merges overall
+3. The merge state is kept between merges, so its buffer is allocated once per growth
+Equal elements keep the order in which they were appended. Powersort needs the final length
+in advance, so only policies with MS_RUN_STACK are accepted
+*/
+
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "TimSort.h"
+
+template <class Type, class Compare = std::less<Type>, class Policy = DefaultTimSortPolicy>
+class TimSortedBuffer
+{
+    static_assert(Policy::getMergeStrategy() == MS_RUN_STACK, "TimSortedBuffer merges by the run stack only");
+
+public:
+    typedef typename std::vector<Type>::iterator Iterator;
+    typedef typename std::vector<Type>::const_iterator ConstIterator;
+
+    explicit TimSortedBuffer(Compare comp = Compare()):
+        comp (comp),
+        merge_state (Policy::getMergeBufferBudget(), std::numeric_limits<std::ptrdiff_t>::max(), Policy::getGallop(), stats)
+
+        {}
+
+    //The merge state is not shared, a copy allocates its own
+    TimSortedBuffer(const TimSortedBuffer& that):
+        data (that.data),
+        runs (that.runs),
+        comp (that.comp),
+        merge_state (Policy::getMergeBufferBudget(), std::numeric_limits<std::ptrdiff_t>::max(), Policy::getGallop(), stats)
+
+        {}
+
+    TimSortedBuffer(TimSortedBuffer&& that):
+        data (std::move(that.data)),
+        runs (std::move(that.runs)),
+        comp (that.comp),
+        merge_state (Policy::getMergeBufferBudget(), std::numeric_limits<std::ptrdiff_t>::max(), Policy::getGallop(), stats)
+
+        {}
+
+    TimSortedBuffer& operator =(TimSortedBuffer that)
+    {
+        data = std::move(that.data);
+        runs = std::move(that.runs);
+        comp = that.comp;
+        return *this;
+    }
+
+    void append(const Type& value)
+    {
+        data.push_back(value);
+        addRun(data.size() - 1);
+    }
+
+    void append(Type&& value)
+    {
+        data.push_back(std::move(value));
+        addRun(data.size() - 1);
+    }
+
+    //The batch need not be sorted
+    template <class InputIterator>
+    void append(InputIterator first, InputIterator last)
+    {
+        std::ptrdiff_t batch_start = data.size();
+        data.insert(data.end(), first, last);
+        if (static_cast<std::ptrdiff_t>(data.size()) == batch_start)
+            return;
+
+        timSort<Policy>(data.begin() + batch_start, data.end(), comp);
+        addRun(batch_start);
+    }
+
+    std::ptrdiff_t size() const
+    {
+        return data.size();
+    }
+
+    bool empty() const
+    {
+        return data.empty();
+    }
+
+    void clear()
+    {
+        data.clear();
+        runs.clear();
+    }
+
+    void reserve(std::ptrdiff_t capacity)
+    {
+        data.reserve(capacity);
+    }
+
+    //Number of sorted runs not merged yet
+    std::ptrdiff_t getRunsNumber() const
+    {
+        return runs.size();
+    }
+
+    ConstIterator begin()
+    {
+        mergeAll();
+        return data.begin();
+    }
+
+    ConstIterator end()
+    {
+        return data.end();
+    }
+
+    const std::vector<Type>& getSorted()
+    {
+        mergeAll();
+        return data;
+    }
+
+    //First element not less than key
+    ConstIterator lowerBound(const Type& key)
+    {
+        mergeAll();
+        ConstIterator start = data.begin(), finish = data.end();
+        while (start < finish)
+        {
+            ConstIterator med = start + (finish - start) / 2;
+            if (comp(*med, key))
+                start = med + 1;
+            else
+                finish = med;
+        }
+        return start;
+    }
+
+    //First element greater than key
+    ConstIterator upperBound(const Type& key)
+    {
+        mergeAll();
+        ConstIterator start = data.begin(), finish = data.end();
+        while (start < finish)
+        {
+            ConstIterator med = start + (finish - start) / 2;
+            if (comp(key, *med))
+                finish = med;
+            else
+                start = med + 1;
+        }
+        return start;
+    }
+
+    bool contains(const Type& key)
+    {
+        ConstIterator found = lowerBound(key);
+        return found != data.end() && !comp(key, *found);
+    }
+
+    //Merges all runs, so the next lookups and iterations are cheap
+    void mergeAll()
+    {
+        while (runs.size() > 1)
+            mergeAt(runs.size() - 2);
+    }
+
+private:
+    struct RunBounds
+    {
+        std::ptrdiff_t start;
+        std::ptrdiff_t size;
+    };
+
+    //Sorted elements from run_start to the end of data become the newest run
+    void addRun(std::ptrdiff_t run_start)
+    {
+        std::ptrdiff_t run_size = data.size() - run_start;
+
+        //A batch continuing the last run, or small enough for insertion into it, extends it
+        if (!runs.empty())
+        {
+            RunBounds& last = runs.back();
+            if (!comp(data[run_start], data[run_start - 1]))
+            {
+                last.size += run_size;
+                return;
+            }
+            if (last.size + run_size <= MAX_MIN_RUN_LENGTH)
+            {
+                binaryInsertionSort(data.begin() + last.start, data.begin() + run_start, data.end(), comp);
+                last.size += run_size;
+                return;
+            }
+        }
+
+        RunBounds run = {run_start, run_size};
+        runs.push_back(run);
+        collapse();
+    }
+
+    //Restores the invariants of the policy on the top of the run stack
+    void collapse()
+    {
+        while (runs.size() > 1)
+        {
+            size_t n_runs = runs.size();
+            std::ptrdiff_t len_x = runs[n_runs - 1].size;
+            std::ptrdiff_t len_y = runs[n_runs - 2].size;
+
+            if (n_runs > 2)
+            {
+                EWhatMerge merge_type = Policy::whatMerge(len_x, len_y, runs[n_runs - 3].size);
+                if (merge_type == WM_MERGE_XY)
+                {
+                    mergeAt(n_runs - 2);
+                    continue;
+                }
+                if (merge_type == WM_MERGE_YZ)
+                {
+                    mergeAt(n_runs - 3);
+                    continue;
+                }
+            }
+
+            if (!Policy::needMerge(len_x, len_y))
+                break;
+            mergeAt(n_runs - 2);
+        }
+    }
+
+    //Merges runs i and i + 1
+    void mergeAt(size_t i)
+    {
+        Run<Iterator> left = {data.begin() + runs[i].start, runs[i].size};
+        Run<Iterator> right = {data.begin() + runs[i + 1].start, runs[i + 1].size};
+        mergeRuns(left, right, comp, merge_state);
+
+        runs[i].size += runs[i + 1].size;
+        runs.erase(runs.begin() + i + 1);
+    }
+
+    std::vector<Type> data;
+    std::vector<RunBounds> runs;
+    Compare comp;
+    NoTimSortStats stats;
+    MergeState<Iterator> merge_state;
+};
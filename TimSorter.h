@@ -0,0 +1,73 @@
+/*
+TimSorter.h
+Reusable sorter keeping its memory between sorts
+1. Offers template class TimSorter owning the merge buffer and the run stack of timSort:
+   they grow geometrically when a sort needs more and are reused by the next sorts
+2. reserve allocates everything a sort of up to the given length needs, after it
+   sorts of such lengths do no heap allocation; in-place merges under NO_MERGE_BUFFER
+   sort their blocks in place and allocate nothing either
+One TimSorter must not be used by several threads at once, give each thread its own
+*/
+
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "TimSort.h"
+
+//Depth the run stack can reach on any array while the invariants of DefaultTimSortPolicy hold
+const size_t MAX_RUN_STACK_DEPTH = 2 * MAX_POWERSORT_STACK;
+
+//params must live as long as the sorter
+template <class Type, class Compare = std::less<Type>,
+          class RandomAccessIterator = typename std::vector<Type>::iterator>
+class TimSorter
+{
+public:
+    explicit TimSorter(Compare comp = Compare(), const ITimSortParams& params = DEFAULT_PARAMS):
+        comp (comp),
+        params (params),
+        merge_state (params.getMergeBufferBudget(), 0, params.getGallop(), stats),
+        merger (comp, params, merge_state)
+    {
+        merger.reserveStack(MAX_RUN_STACK_DEPTH);
+    }
+
+    TimSorter(const TimSorter&) = delete;
+    TimSorter& operator =(const TimSorter&) = delete;
+
+    //Allocates the merge buffer needed by sorts of up to max_size elements
+    void reserve(std::ptrdiff_t max_size)
+    {
+        merge_state.restart(max_size);
+        merge_state.reserve(merge_state.getCapacity());
+    }
+
+    void sort(RandomAccessIterator start, RandomAccessIterator finish)
+    {
+        timSortReusing(start, finish, comp, params, merge_state, merger, stats);
+    }
+
+    //Memory kept between sorts, sorts after a large enough reserve leave it as it is
+    const Type* getMergeBuffer() const
+    {
+        return merge_state.getBuffer();
+    }
+
+    std::ptrdiff_t getMergeBufferSize() const
+    {
+        return merge_state.getAllocated();
+    }
+
+    size_t getStackCapacity() const
+    {
+        return merger.getStackCapacity();
+    }
+
+private:
+    Compare comp;
+    const ITimSortParams& params;
+    NoTimSortStats stats;
+    MergeState<RandomAccessIterator> merge_state;
+    RunStackMerger<RandomAccessIterator, Compare, ITimSortParams, NoTimSortStats> merger;
+};